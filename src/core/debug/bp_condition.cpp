@@ -0,0 +1,405 @@
+#include "bp_condition.h"
+
+#include <ctype.h>
+#include <stdexcept>
+#include <string.h>
+
+#include "context_mgr.h"
+#include "sym_tab.h"
+#include "sym_type_tree.h"
+#include "symbol.h"
+#include "target.h"
+
+namespace debug::core {
+
+  /** recursive descent over the C precedence levels, emits postfix
+  */
+  class bp_condition::parser {
+  public:
+    parser(dbg_session *session, const context &ctx, const std::string &text, bp_condition &out)
+        : session(session)
+        , ctx(ctx)
+        , text(text)
+        , pos(0)
+        , out(out) {}
+
+    void parse() {
+      parse_binary(0);
+      skip_space();
+      if (pos != text.size()) {
+        throw std::runtime_error("unexpected \"" + text.substr(pos) + "\"");
+      }
+    }
+
+  private:
+    struct binary_op {
+      const char *token;
+      int level;
+      op_code code;
+    };
+
+    // two character tokens first, so "<" does not match "<<"
+    static constexpr binary_op binary_ops[] = {
+        {"||", 0, OP_LOR},
+        {"&&", 1, OP_LAND},
+        {"==", 5, OP_EQ},
+        {"!=", 5, OP_NE},
+        {"<=", 6, OP_LE},
+        {">=", 6, OP_GE},
+        {"<<", 7, OP_SHL},
+        {">>", 7, OP_SHR},
+        {"|", 2, OP_OR},
+        {"^", 3, OP_XOR},
+        {"&", 4, OP_AND},
+        {"<", 6, OP_LT},
+        {">", 6, OP_GT},
+        {"+", 8, OP_ADD},
+        {"-", 8, OP_SUB},
+        {"*", 9, OP_MUL},
+        {"/", 9, OP_DIV},
+        {"%", 9, OP_MOD},
+    };
+    static constexpr int UNARY_LEVEL = 10;
+
+    dbg_session *session;
+    const context &ctx;
+    const std::string &text;
+    size_t pos;
+    bp_condition &out;
+
+    void skip_space() {
+      while (pos < text.size() && isspace(text[pos])) {
+        pos++;
+      }
+    }
+
+    bool accept(char c) {
+      skip_space();
+      if (pos < text.size() && text[pos] == c) {
+        pos++;
+        return true;
+      }
+      return false;
+    }
+
+    void expect(char c) {
+      if (!accept(c)) {
+        throw std::runtime_error(std::string("expected '") + c + "'");
+      }
+    }
+
+    void emit(op_code code, int64_t value = 0) {
+      out.program.push_back({code, value});
+    }
+
+    void parse_binary(int level) {
+      if (level == UNARY_LEVEL) {
+        parse_unary();
+        return;
+      }
+
+      parse_binary(level + 1);
+      while (true) {
+        skip_space();
+
+        const binary_op *match = nullptr;
+        for (const auto &op : binary_ops) {
+          if (text.compare(pos, strlen(op.token), op.token) == 0) {
+            match = &op;
+            break;
+          }
+        }
+        if (match == nullptr || match->level != level) {
+          return;
+        }
+
+        pos += strlen(match->token);
+        parse_binary(level + 1);
+        emit(match->code);
+      }
+    }
+
+    void parse_unary() {
+      if (accept('!')) {
+        parse_unary();
+        emit(OP_NOT);
+      } else if (accept('~')) {
+        parse_unary();
+        emit(OP_INV);
+      } else if (accept('-')) {
+        parse_unary();
+        emit(OP_NEG);
+      } else if (accept('+')) {
+        parse_unary();
+      } else {
+        parse_primary();
+      }
+    }
+
+    int64_t parse_number() {
+      skip_space();
+      size_t len = 0;
+      int64_t value = 0;
+      try {
+        value = std::stoll(text.substr(pos), &len, 0);
+      } catch (std::exception &) {
+        throw std::runtime_error("expected a number at \"" + text.substr(pos) + "\"");
+      }
+      pos += len;
+      // C suffixes carry no meaning here
+      while (pos < text.size() && (text[pos] == 'u' || text[pos] == 'U' || text[pos] == 'l' || text[pos] == 'L')) {
+        pos++;
+      }
+      return value;
+    }
+
+    std::string parse_ident() {
+      skip_space();
+      const size_t start = pos;
+      while (pos < text.size() && (isalnum(text[pos]) || text[pos] == '_')) {
+        pos++;
+      }
+      if (start == pos) {
+        throw std::runtime_error("expected a name at \"" + text.substr(pos) + "\"");
+      }
+      return text.substr(start, pos - start);
+    }
+
+    void parse_primary() {
+      skip_space();
+      if (accept('(')) {
+        parse_binary(0);
+        expect(')');
+      } else if (pos < text.size() && isdigit(text[pos])) {
+        emit(OP_CONST, parse_number());
+      } else if (pos < text.size() && text[pos] == '\'') {
+        if (pos + 2 >= text.size() || text[pos + 2] != '\'') {
+          throw std::runtime_error("bad character constant");
+        }
+        emit(OP_CONST, text[pos + 1]);
+        pos += 3;
+      } else {
+        parse_variable();
+      }
+    }
+
+    void parse_variable() {
+      const std::string name = parse_ident();
+
+      symbol *sym = session->symtab()->get_symbol(ctx, name);
+      if (sym == nullptr) {
+        throw std::runtime_error("No symbol \"" + name + "\" in current context.");
+      }
+
+      target_addr addr = sym->addr();
+      sym_type *type = session->symtree()->get_type(sym->type_name(), ctx);
+      bool is_array = sym->is_type(symbol::ARRAY);
+
+      if (addr.space == target_addr::AS_REGISTER) {
+        // consecutive registers, lowest byte first
+        int first = -1;
+        int next = -1;
+        for (const auto &r : sym->regs()) {
+          if (r.size() < 2 || (r[0] != 'r' && r[0] != 'R')) {
+            throw std::runtime_error("\"" + name + "\" is not in r0-r7");
+          }
+          const int n = std::stoi(r.substr(1));
+          if (first < 0) {
+            first = n;
+          } else if (n != next) {
+            throw std::runtime_error("\"" + name + "\" is split over registers");
+          }
+          next = n + 1;
+        }
+        addr.addr = first;
+      }
+
+      switch (addr.space) {
+      case target_addr::AS_XSTACK:
+      case target_addr::AS_ISTACK:
+        throw std::runtime_error("\"" + name + "\" is on the stack");
+      case target_addr::AS_BIT:
+      case target_addr::AS_SBIT:
+      case target_addr::AS_UNDEF:
+        throw std::runtime_error("\"" + name + "\" can not be read");
+      default:
+        break;
+      }
+
+      while (true) {
+        if (accept('[')) {
+          if (!is_array || type == nullptr) {
+            throw std::runtime_error("\"" + name + "\" is not an array");
+          }
+          const int64_t index = parse_number();
+          expect(']');
+          addr = addr + ADDR(index * type->size());
+          is_array = false;
+        } else if (accept('.')) {
+          auto st = dynamic_cast<sym_type_struct *>(type);
+          const std::string member = parse_ident();
+          if (is_array || st == nullptr || st->get_member_type(member) == nullptr) {
+            throw std::runtime_error("no member \"" + member + "\" in \"" + name + "\"");
+          }
+          addr = addr + st->get_member_offset(member);
+          type = st->get_member_type(member);
+        } else {
+          break;
+        }
+      }
+
+      if (is_array || type == nullptr || !type->terminal() || type->size() > 4) {
+        throw std::runtime_error("\"" + name + "\" is not a scalar");
+      }
+      if (type->text() == "float") {
+        throw std::runtime_error("\"" + name + "\" is a float");
+      }
+
+      // cdb_file names the type from the sign sdcc records for the symbol,
+      // "char" only for a signed one, plain char is unsigned by default
+      const std::string &t = type->text();
+      const bool is_signed = t == "char" || t == "short" || t == "int" || t == "long";
+      out.loads.push_back({addr, uint8_t(type->size()), is_signed});
+      emit(OP_LOAD, out.loads.size() - 1);
+    }
+  };
+
+  constexpr bp_condition::parser::binary_op bp_condition::parser::binary_ops[];
+
+  bp_condition::bp_condition() {
+  }
+
+  bool bp_condition::compile(dbg_session *session, ADDR addr, const std::string &text, std::string &error) {
+    bp_condition result;
+    result.expr = text;
+
+    if (text.find_first_not_of(" \t") != std::string::npos) {
+      const context ctx = session->contextmgr()->build_context(addr);
+      try {
+        parser(session, ctx, text, result).parse();
+      } catch (std::runtime_error &e) {
+        error = e.what();
+        return false;
+      }
+    }
+
+    *this = result;
+    return true;
+  }
+
+  void bp_condition::add_ranges(std::vector<mem_range> &ranges, uint8_t *buf) const {
+    for (size_t i = 0; i < loads.size(); i++) {
+      ranges.push_back({loads[i].addr, loads[i].size, buf + i * 4});
+    }
+  }
+
+  int64_t bp_condition::value(const uint8_t *buf) const {
+    if (program.empty()) {
+      return 1;
+    }
+
+    std::vector<int64_t> values(loads.size());
+    for (size_t i = 0; i < loads.size(); i++) {
+      // little endian, as sdcc lays them out
+      uint32_t v = 0;
+      for (int b = loads[i].size - 1; b >= 0; b--) {
+        v = (v << 8) | buf[i * 4 + b];
+      }
+      const uint32_t sign = 1u << (loads[i].size * 8 - 1);
+      if (loads[i].is_signed && (v & sign)) {
+        values[i] = int64_t(v) - (int64_t(sign) << 1);
+      } else {
+        values[i] = v;
+      }
+    }
+
+    std::vector<int64_t> stack;
+    stack.reserve(program.size());
+    for (const auto &o : program) {
+      if (o.code == OP_CONST) {
+        stack.push_back(o.value);
+        continue;
+      }
+      if (o.code == OP_LOAD) {
+        stack.push_back(values[o.value]);
+        continue;
+      }
+
+      int64_t &a = o.code <= OP_INV ? stack.back() : stack[stack.size() - 2];
+      const int64_t b = stack.back();
+      switch (o.code) {
+      case OP_NEG:
+        a = -a;
+        break;
+      case OP_NOT:
+        a = !a;
+        break;
+      case OP_INV:
+        a = ~a;
+        break;
+      case OP_MUL:
+        a = a * b;
+        break;
+      case OP_DIV:
+        a = b == 0 ? 0 : a / b;
+        break;
+      case OP_MOD:
+        a = b == 0 ? 0 : a % b;
+        break;
+      case OP_ADD:
+        a = a + b;
+        break;
+      case OP_SUB:
+        a = a - b;
+        break;
+      case OP_SHL:
+        a = a << (b & 0x3f);
+        break;
+      case OP_SHR:
+        a = a >> (b & 0x3f);
+        break;
+      case OP_LT:
+        a = a < b;
+        break;
+      case OP_LE:
+        a = a <= b;
+        break;
+      case OP_GT:
+        a = a > b;
+        break;
+      case OP_GE:
+        a = a >= b;
+        break;
+      case OP_EQ:
+        a = a == b;
+        break;
+      case OP_NE:
+        a = a != b;
+        break;
+      case OP_AND:
+        a = a & b;
+        break;
+      case OP_XOR:
+        a = a ^ b;
+        break;
+      case OP_OR:
+        a = a | b;
+        break;
+      case OP_LAND:
+        a = a && b;
+        break;
+      case OP_LOR:
+        a = a || b;
+        break;
+      default:
+        break;
+      }
+      if (o.code > OP_INV) {
+        stack.pop_back();
+      }
+    }
+
+    return stack.back();
+  }
+
+} // namespace debug::core
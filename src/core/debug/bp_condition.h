@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "dbg_session.h"
+#include "mem_remap.h"
+#include "types.h"
+
+namespace debug::core {
+
+  struct mem_range;
+
+  /** breakpoint condition, compiled once into a small stack program so a hit
+    only costs the reads of the variables it uses. tracepoints use it for the
+    expressions they collect.
+
+    integer constants, scalar variables with constant array subscripts and
+    struct members, the C unary and binary operators and parentheses.
+    variables on the stack are not supported.
+  */
+  class bp_condition {
+  public:
+    bp_condition();
+
+    /** compile expr with the symbols visible at addr, an empty expr always holds.
+      false with a message in error when it does not compile, the previous
+      condition is kept then.
+    */
+    bool compile(dbg_session *session, ADDR addr, const std::string &expr, std::string &error);
+
+    bool empty() const { return program.empty(); }
+    const std::string &text() const { return expr; }
+
+    /** the reads of the variables, to be merged with others. buf needs
+      data_size() bytes and must stay valid until value() is called on it
+    */
+    size_t data_size() const { return loads.size() * 4; }
+    void add_ranges(std::vector<mem_range> &ranges, uint8_t *buf) const;
+    int64_t value(const uint8_t *buf) const;
+
+  protected:
+    class parser;
+
+    enum op_code {
+      OP_CONST,
+      OP_LOAD,
+      OP_NEG,
+      OP_NOT,
+      OP_INV,
+      OP_MUL,
+      OP_DIV,
+      OP_MOD,
+      OP_ADD,
+      OP_SUB,
+      OP_SHL,
+      OP_SHR,
+      OP_LT,
+      OP_LE,
+      OP_GT,
+      OP_GE,
+      OP_EQ,
+      OP_NE,
+      OP_AND,
+      OP_XOR,
+      OP_OR,
+      OP_LAND,
+      OP_LOR,
+    };
+
+    struct op {
+      op_code code;
+      // constant or load index
+      int64_t value;
+    };
+
+    struct load {
+      target_addr addr;
+      uint8_t size;
+      bool is_signed;
+    };
+
+    std::string expr;
+    std::vector<op> program;
+    std::vector<load> loads;
+  };
+
+} // namespace debug::core
@@ -1,6 +1,10 @@
 #include "breakpoint_mgr.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
 #include <stdio.h>
+#include <stdlib.h>
 #include <vector>
 
 #include "dbg_session.h"
@@ -11,6 +15,35 @@
 
 namespace debug::core {
 
+  // hit conditions as the dap clients send them, a plain number means >=
+  static bool parse_hit_condition(const std::string &expr, char &op, uint32_t &count) {
+    size_t pos = expr.find_first_not_of(" \t");
+    if (pos == std::string::npos) {
+      op = 0;
+      count = 0;
+      return true;
+    }
+
+    op = 'g';
+    if (expr.compare(pos, 2, ">=") == 0) {
+      pos += 2;
+    } else if (expr.compare(pos, 2, "==") == 0) {
+      op = '=';
+      pos += 2;
+    } else if (expr[pos] == '>' || expr[pos] == '%' || expr[pos] == '=') {
+      op = expr[pos];
+      pos++;
+    }
+
+    char *end = nullptr;
+    const std::string number = expr.substr(pos);
+    count = strtoul(number.c_str(), &end, 0);
+    if (end == number.c_str() || std::string(end).find_first_not_of(" \t") != std::string::npos) {
+      return false;
+    }
+    return op != '%' || count != 0;
+  }
+
   breakpoint_mgr::breakpoint_mgr(dbg_session *session)
       : session(session) {
   }
@@ -20,12 +53,10 @@ namespace debug::core {
       return BP_ID_INVALID;
     }
 
-    breakpoint ent = {
-        next_id(),
-        addr,
-        temporary,
-        false,
-    };
+    breakpoint ent;
+    ent.id = next_id();
+    ent.addr = addr;
+    ent.temporary = temporary;
 
     bplist.push_back(ent);
     return ent.id;
@@ -34,6 +65,7 @@ namespace debug::core {
   void breakpoint_mgr::clear_all() {
     log::print("Clearing all breakpoints.\n");
     bplist.clear();
+    step_bps.clear();
     log::print("Clearing all breakpoints in target.\n");
     session->target()->clear_all_breakpoints();
   }
@@ -43,21 +75,317 @@ namespace debug::core {
 
     session->target()->clear_all_breakpoints();
 
-    std::vector<ADDR> loaded;
-    for (auto it = bplist.begin(); it != bplist.end(); ++it) {
-      std::vector<ADDR>::iterator lit;
-      for (lit = loaded.begin(); lit != loaded.end(); ++lit) {
-        if (it->addr == *(lit))
-          break;
+    std::set<ADDR> loaded;
+    for (const auto &bp : bplist) {
+      if (bp.disabled || loaded.count(bp.addr)) {
+        continue;
       }
-      if (lit == loaded.end()) {
-        if (session->target()->add_breakpoint(it->addr)) {
-          loaded.push_back(it->addr);
-        } else {
-          log::print("Reloading breakpoint {} failed\n", it->id);
+      if (session->target()->add_breakpoint(bp.addr) || session->target()->add_sw_breakpoint(bp.addr)) {
+        loaded.insert(bp.addr);
+      } else {
+        log::print("Reloading breakpoint {} failed\n", bp.id);
+      }
+    }
+  }
+
+  std::vector<bp_id> breakpoint_mgr::sync_source(const std::string &source, const std::vector<std::string> &specs) {
+    std::vector<bp_id> ids(specs.size(), BP_ID_INVALID);
+
+    std::vector<line_spec> wanted;
+    std::set<ADDR> wanted_addrs;
+    for (const auto &spec : specs) {
+      wanted.push_back(line_spec::create(session, spec));
+      if (wanted.back().valid()) {
+        wanted_addrs.insert(wanted.back().addr);
+      }
+    }
+
+    // drop what is no longer requested first, freeing slots for the new ones
+    std::map<ADDR, bp_id> kept;
+    for (auto it = bplist.begin(); it != bplist.end();) {
+      if (it->source != source) {
+        ++it;
+        continue;
+      }
+      if (wanted_addrs.count(it->addr) && !kept.count(it->addr)) {
+        kept[it->addr] = it->id;
+        ++it;
+        continue;
+      }
+
+      const ADDR addr = it->addr;
+      it = bplist.erase(it);
+      del_target_bp(addr);
+    }
+
+    for (size_t i = 0; i < specs.size(); i++) {
+      if (!wanted[i].valid()) {
+        continue;
+      }
+
+      auto it = kept.find(wanted[i].addr);
+      if (it != kept.end()) {
+        ids[i] = it->second;
+        continue;
+      }
+
+      ids[i] = set_breakpoint(specs[i]);
+      if (ids[i] != BP_ID_INVALID) {
+        bplist.back().source = source;
+        kept[wanted[i].addr] = ids[i];
+      }
+    }
+
+    return ids;
+  }
+
+  // bytes read at a hit for the condition and what a tracepoint collects
+  static size_t collect_size(const breakpoint &bp) {
+    size_t size = bp.condition.data_size();
+    for (const auto &item : bp.collect) {
+      size += item.len ? item.len : item.expr.data_size();
+    }
+    return size;
+  }
+
+  static void add_collect_ranges(const breakpoint &bp, std::vector<mem_range> &ranges, uint8_t *buf) {
+    bp.condition.add_ranges(ranges, buf);
+    buf += bp.condition.data_size();
+    for (const auto &item : bp.collect) {
+      if (item.len) {
+        ranges.push_back({item.addr, item.len, buf});
+        buf += item.len;
+      } else {
+        item.expr.add_ranges(ranges, buf);
+        buf += item.expr.data_size();
+      }
+    }
+  }
+
+  void breakpoint_mgr::run_to_bp(int ignore_cnt) {
+    target *t = session->target();
+
+    // a stop request from before this run is stale
+    t->check_stop_forced();
+
+    while (true) {
+      t->run_to_bp();
+      if (t->check_stop_forced()) {
+        return;
+      }
+
+      // conditions that do not hold and tracepoints resume right away,
+      // no context is built and the records are made after resuming
+      const auto halted = std::chrono::steady_clock::now();
+      if (!should_stop(t->read_PC())) {
+        t->go();
+        record_traces(halted, std::chrono::steady_clock::now());
+        continue;
+      }
+
+      // stopping here, the halt of the hits ends now and not when the
+      // user resumes
+      record_traces(halted, std::chrono::steady_clock::now());
+      if (ignore_cnt-- > 0) {
+        continue;
+      }
+      return;
+    }
+  }
+
+  bool breakpoint_mgr::should_stop(ADDR addr) {
+    bool stop = std::find(step_bps.begin(), step_bps.end(), addr) != step_bps.end();
+
+    std::vector<breakpoint *> hit;
+    for (auto &bp : bplist) {
+      if (bp.addr == addr && !bp.disabled) {
+        hit.push_back(&bp);
+      }
+    }
+    if (hit.empty()) {
+      // halted for some other reason, e.g. a step or a halt request
+      return true;
+    }
+
+    // conditions and everything the tracepoints collect in one read
+    std::vector<std::vector<uint8_t>> data(hit.size());
+    std::vector<mem_range> ranges;
+    for (size_t i = 0; i < hit.size(); i++) {
+      data[i].resize(collect_size(*hit[i]));
+      add_collect_ranges(*hit[i], ranges, data[i].data());
+    }
+    session->target()->read_memory_v(ranges);
+
+    for (size_t i = 0; i < hit.size(); i++) {
+      breakpoint &bp = *hit[i];
+      if (bp.condition.value(data[i].data()) == 0) {
+        continue;
+      }
+      if (bp.ignore_count > 0) {
+        bp.ignore_count--;
+        continue;
+      }
+
+      bp.hits++;
+      bool holds = true;
+      switch (bp.hit_op) {
+      case 'g':
+        holds = bp.hits >= bp.hit_count;
+        break;
+      case '=':
+        holds = bp.hits == bp.hit_count;
+        break;
+      case '>':
+        holds = bp.hits > bp.hit_count;
+        break;
+      case '%':
+        holds = bp.hits % bp.hit_count == 0;
+        break;
+      default:
+        break;
+      }
+
+      if (!holds) {
+        continue;
+      }
+      if (bp.tracepoint) {
+        pending.push_back({&bp, std::move(data[i])});
+        continue;
+      }
+      stop = true;
+    }
+
+    return stop;
+  }
+
+  void breakpoint_mgr::record_traces(std::chrono::steady_clock::time_point halted, std::chrono::steady_clock::time_point end) {
+    const auto halt = std::chrono::duration_cast<std::chrono::microseconds>(end - halted);
+    for (auto &p : pending) {
+      p.bp->traced++;
+      p.bp->halt_total += halt;
+      p.bp->halt_max = std::max(p.bp->halt_max, halt);
+      traces.push(halted, halt, p.bp->id, p.bp->addr, trace_text(*p.bp, p.data.data()));
+    }
+    pending.clear();
+  }
+
+  std::string breakpoint_mgr::trace_text(const breakpoint &bp, const uint8_t *data) {
+    std::vector<std::string> values;
+    data += bp.condition.data_size();
+    for (const auto &item : bp.collect) {
+      if (item.len) {
+        std::string bytes;
+        for (uint32_t i = 0; i < item.len; i++) {
+          bytes += fmt::format(i ? " {:02x}" : "{:02x}", data[i]);
         }
+        values.push_back(bytes);
+        data += item.len;
+      } else {
+        values.push_back(std::to_string(item.expr.value(data)));
+        data += item.expr.data_size();
+      }
+    }
+
+    if (bp.message.empty()) {
+      std::string text;
+      for (size_t i = 0; i < values.size(); i++) {
+        text += fmt::format(i ? ", {} = {}" : "{} = {}", bp.collect[i].text, values[i]);
+      }
+      return text;
+    }
+
+    std::string text = bp.message;
+    for (size_t i = 0; i < values.size(); i++) {
+      const std::string key = "{" + bp.collect[i].text + "}";
+      for (size_t pos = text.find(key); pos != std::string::npos; pos = text.find(key, pos + values[i].size())) {
+        text.replace(pos, key.size(), values[i]);
       }
     }
+    return text;
+  }
+
+  bool breakpoint_mgr::set_condition(bp_id id, const std::string &expr, std::string &error) {
+    breakpoint *bp = find(id);
+    if (bp == nullptr) {
+      error = fmt::format("No breakpoint number {}.", id);
+      return false;
+    }
+    if (bp->condition.text() == expr) {
+      return true;
+    }
+    return bp->condition.compile(session, bp->addr, expr, error);
+  }
+
+  bool breakpoint_mgr::set_hit_condition(bp_id id, const std::string &expr, std::string &error) {
+    breakpoint *bp = find(id);
+    if (bp == nullptr) {
+      error = fmt::format("No breakpoint number {}.", id);
+      return false;
+    }
+    if (bp->hit_condition == expr) {
+      return true;
+    }
+
+    char op;
+    uint32_t count;
+    if (!parse_hit_condition(expr, op, count)) {
+      error = fmt::format("Invalid hit condition \"{}\".", expr);
+      return false;
+    }
+    bp->hit_condition = expr;
+    bp->hit_op = op;
+    bp->hit_count = count;
+    bp->hits = 0;
+    return true;
+  }
+
+  bool breakpoint_mgr::set_ignore_count(bp_id id, uint32_t count) {
+    breakpoint *bp = find(id);
+    if (bp == nullptr) {
+      return false;
+    }
+    bp->ignore_count = count;
+    return true;
+  }
+
+  bool breakpoint_mgr::set_trace(bp_id id, bool enabled, const std::vector<std::string> &items, const std::string &message, std::string &error) {
+    breakpoint *bp = find(id);
+    if (bp == nullptr) {
+      error = fmt::format("No breakpoint number {}.", id);
+      return false;
+    }
+
+    std::vector<trace_item> collect;
+    for (const auto &text : items) {
+      trace_item item;
+      item.text = text;
+      const size_t at = text.find('@');
+      if (at != std::string::npos) {
+        item.addr = mem_remap::target(strtoul(text.substr(0, at).c_str(), 0, 0));
+        item.len = strtoul(text.substr(at + 1).c_str(), 0, 0);
+        if (!item.addr.valid() || item.len == 0) {
+          error = fmt::format("Invalid memory range \"{}\".", text);
+          return false;
+        }
+      } else if (!item.expr.compile(session, bp->addr, text, error)) {
+        return false;
+      }
+      collect.push_back(item);
+    }
+
+    bp->tracepoint = enabled;
+    bp->collect = std::move(collect);
+    bp->message = message;
+    return true;
+  }
+
+  breakpoint *breakpoint_mgr::find(bp_id id) {
+    for (auto &bp : bplist) {
+      if (bp.id == id) {
+        return &bp;
+      }
+    }
+    return nullptr;
   }
 
   void breakpoint_mgr::dump() {
@@ -68,12 +396,34 @@ namespace debug::core {
 
     log::printf("Num Type           Disp Enb Address            What\n");
     for (auto it = bplist.begin(); it != bplist.end(); ++it) {
-      log::printf("%-4ibreakpoint     %-5s%-4c0x%04x             %s\n",
+      log::printf("%-4i%-15s%-5s%-4c0x%04x             %s\n",
                   it->id,
+                  it->tracepoint ? "tracepoint" : "breakpoint",
                   it->temporary ? "del " : "keep",
                   it->disabled ? 'n' : 'y',
                   it->addr,
                   it->what.c_str());
+      if (!it->condition.empty()) {
+        log::print("\tstop only if {}\n", it->condition.text());
+      }
+      if (!it->hit_condition.empty()) {
+        log::print("\tstop only if hit count {}\n", it->hit_condition);
+      }
+      if (it->hits) {
+        log::print("\tbreakpoint already hit {} time{}\n", it->hits, it->hits == 1 ? "" : "s");
+      }
+      if (it->ignore_count) {
+        log::print("\tWill ignore next {} crossings of breakpoint.\n", it->ignore_count);
+      }
+      for (const auto &item : it->collect) {
+        log::print("\tcollect {}\n", item.text);
+      }
+      if (it->traced) {
+        log::print("\ttraced {} times, halted {}us on average, {}us at most\n",
+                   it->traced,
+                   it->halt_total.count() / it->traced,
+                   it->halt_max.count());
+      }
     }
   }
 
@@ -122,13 +472,11 @@ namespace debug::core {
       return BP_ID_INVALID;
     }
 
-    breakpoint ent = {
-        next_id(),
-        ls.addr,
-        temporary,
-        false,
-        cmd,
-    };
+    breakpoint ent;
+    ent.id = next_id();
+    ent.addr = ls.addr;
+    ent.temporary = temporary;
+    ent.what = cmd;
     if (!add_target_bp(ent.addr)) {
       return BP_ID_INVALID;
     }
@@ -228,9 +576,28 @@ namespace debug::core {
     return false; // no breakpoint at the specified address.
   }
 
+  bool breakpoint_mgr::add_step_bp(ADDR addr) {
+    if (active_bp_at(addr) || std::find(step_bps.begin(), step_bps.end(), addr) != step_bps.end()) {
+      return true;
+    }
+    if (!session->target()->add_breakpoint(addr)) {
+      return false;
+    }
+    step_bps.push_back(addr);
+    return true;
+  }
+
+  void breakpoint_mgr::clear_step_bps() {
+    for (const auto addr : step_bps) {
+      del_target_bp(addr);
+    }
+    step_bps.clear();
+  }
+
   bool breakpoint_mgr::add_target_bp(ADDR addr) {
     if (!active_bp_at(addr)) {
-      return session->target()->add_breakpoint(addr);
+      // hardware slots first, the target patches its code for the rest
+      return session->target()->add_breakpoint(addr) || session->target()->add_sw_breakpoint(addr);
     }
     log::printf("BP already active at this address\n");
     return true; // already a bp at this address in target.
@@ -238,7 +605,7 @@ namespace debug::core {
 
   bool breakpoint_mgr::del_target_bp(ADDR addr) {
     if (!active_bp_at(addr)) {
-      return session->target()->del_breakpoint(addr);
+      return session->target()->del_breakpoint(addr) || session->target()->del_sw_breakpoint(addr);
     }
     return true; // already a bp at this address in target.
   }
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <chrono>
 #include <list>
 #include <string>
+#include <vector>
 
+#include "bp_condition.h"
 #include "dbg_session.h"
+#include "mem_remap.h"
+#include "trace_buffer.h"
 #include "types.h"
 
 namespace debug::core {
@@ -11,14 +16,45 @@ namespace debug::core {
   typedef int32_t bp_id;
   static constexpr bp_id BP_ID_INVALID = -1;
 
+  /** what a tracepoint collects, an expression or a memory range
+  */
+  struct trace_item {
+    std::string text;
+    bp_condition expr;
+    // addr@len, len is 0 for expressions
+    target_addr addr;
+    uint32_t len = 0;
+  };
+
   struct breakpoint {
-    bp_id id;
-    ADDR addr;
+    bp_id id = BP_ID_INVALID;
+    ADDR addr = INVALID_ADDR;
 
-    bool temporary;
-    bool disabled;
+    bool temporary = false;
+    bool disabled = false;
 
     std::string what;
+    // set by sync_source, empty for breakpoints set from the command line
+    std::string source;
+
+    bp_condition condition;
+    // times the condition held, hit_condition is checked against it
+    uint32_t hits = 0;
+    std::string hit_condition;
+    char hit_op = 0;
+    uint32_t hit_count = 0;
+    // gdb style ignore count, counts down before hits does
+    uint32_t ignore_count = 0;
+
+    // collect and continue instead of stopping
+    bool tracepoint = false;
+    std::vector<trace_item> collect;
+    // {item} is replaced by its value, empty lists all items
+    std::string message;
+    // target halt time spent on the recorded hits
+    uint32_t traced = 0;
+    std::chrono::microseconds halt_total{0};
+    std::chrono::microseconds halt_max{0};
   };
 
   class breakpoint_mgr {
@@ -35,6 +71,33 @@ namespace debug::core {
     void reload_all();
     void dump();
 
+    /** makes the breakpoints owned by source match specs, only the
+      difference is sent to the target. returns one id per spec,
+      BP_ID_INVALID for those that could not be set.
+    */
+    std::vector<bp_id> sync_source(const std::string &source, const std::vector<std::string> &specs);
+
+    /** compile a condition for breakpoint id, an empty expr removes it
+    */
+    bool set_condition(bp_id id, const std::string &expr, std::string &error);
+
+    /** stop only once the hit count passes, "N" or ">= N", "== N", "> N", "% N"
+    */
+    bool set_hit_condition(bp_id id, const std::string &expr, std::string &error);
+    bool set_ignore_count(bp_id id, uint32_t count);
+
+    /** turn id into a tracepoint, or back into a breakpoint when not enabled.
+      items are expressions or flat address ranges as addr@len.
+    */
+    bool set_trace(bp_id id, bool enabled, const std::vector<std::string> &items, const std::string &message, std::string &error);
+    trace_buffer &trace() { return traces; }
+
+    /** run until a breakpoint that wants to stop, or a step breakpoint.
+      conditions are evaluated right at the halt and the target resumes
+      without building a context when none of them hold.
+    */
+    void run_to_bp(int ignore_cnt = 0);
+
     bool clear_breakpoint(std::string cmd);
     bool clear_breakpoint_id(bp_id id);
     bool clear_breakpoint_addr(ADDR addr);
@@ -43,11 +106,33 @@ namespace debug::core {
 
     bool active_bp_at(ADDR addr);
 
+    /** unlisted breakpoints the stepping code runs to, a user breakpoint at
+      the same address is reused. false if the target is out of slots.
+    */
+    bool add_step_bp(ADDR addr);
+    void clear_step_bps();
+
   protected:
     dbg_session *session;
     std::list<breakpoint> bplist;
+    std::vector<ADDR> step_bps;
+
+    // tracepoint hits collected at the current halt, recorded once the
+    // target resumed or the run stopped there
+    struct pending_trace {
+      breakpoint *bp;
+      std::vector<uint8_t> data;
+    };
+    std::vector<pending_trace> pending;
+    trace_buffer traces;
 
     int next_id();
+    breakpoint *find(bp_id id);
+
+    bool should_stop(ADDR addr);
+    // the halt of the pending hits lasted from halted to end
+    void record_traces(std::chrono::steady_clock::time_point halted, std::chrono::steady_clock::time_point end);
+    std::string trace_text(const breakpoint &bp, const uint8_t *data);
 
     bool add_target_bp(ADDR addr);
     bool del_target_bp(ADDR addr);
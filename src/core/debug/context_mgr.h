@@ -39,11 +39,12 @@ namespace debug::core {
       return stack;
     }
 
+    // context of addr, without making it the current one
+    context build_context(ADDR addr);
+
   protected:
     dbg_session *session;
     std::vector<context> stack;
-
-    context build_context(ADDR addr);
   };
 
 } // namespace debug::core
@@ -5,9 +5,11 @@
 #include "breakpoint_mgr.h"
 #include "cdb_file.h"
 #include "disassembly.h"
+#include "flow_graph.h"
 #include "log.h"
 #include "module.h"
 #include "registers.h"
+#include "step_engine.h"
 #include "sym_tab.h"
 #include "sym_type_tree.h"
 
@@ -26,7 +28,9 @@ namespace debug {
       , breakpoint_mgr(std::make_unique<core::breakpoint_mgr>(this))
       , module_mgr(std::make_unique<core::module_mgr>())
       , disassembly(std::make_unique<core::disassembly>())
-      , cpu_registers(std::make_unique<core::cpu_registers>(this)) {
+      , flow_graph(std::make_unique<core::flow_graph>())
+      , cpu_registers(std::make_unique<core::cpu_registers>(this))
+      , step_engine(std::make_unique<core::step_engine>(this)) {
 
     current_target = add_target(new core::target_cc())->target_name();
     add_target(new core::target_s51());
@@ -64,10 +68,18 @@ namespace debug {
     return disassembly.get();
   }
 
+  core::flow_graph *dbg_session::flowgraph() {
+    return flow_graph.get();
+  }
+
   core::cpu_registers *dbg_session::regs() {
     return cpu_registers.get();
   }
 
+  core::step_engine *dbg_session::stepper() {
+    return step_engine.get();
+  }
+
   bool dbg_session::load(std::string path, std::string src_dir) {
     core::cdb_file cdbfile(this);
     if (!cdbfile.open(path + ".cdb", src_dir)) {
@@ -75,6 +87,7 @@ namespace debug {
     }
 
     disasm()->load_file(path + ".ihx");
+    flowgraph()->load_file(path + ".ihx");
     return true;
   }
 
@@ -98,6 +111,7 @@ namespace debug {
       symtree()->clear();
       //mcontext_mgr->clear()	@FIXME contextmgr needs a clear or reset
       modulemgr()->reset();
+      flowgraph()->clear();
     }
 
     // select new target
@@ -18,7 +18,9 @@ namespace debug {
     class breakpoint_mgr;
     class module_mgr;
     class disassembly;
+    class flow_graph;
     class cpu_registers;
+    class step_engine;
   } // namespace core
 
   class dbg_session {
@@ -33,7 +35,9 @@ namespace debug {
     core::breakpoint_mgr *bpmgr();
     core::module_mgr *modulemgr();
     core::disassembly *disasm();
+    core::flow_graph *flowgraph();
     core::cpu_registers *regs();
+    core::step_engine *stepper();
 
     bool select_target(std::string name);
     bool load(std::string path, std::string src_dir = "");
@@ -45,7 +49,9 @@ namespace debug {
     std::unique_ptr<core::breakpoint_mgr> breakpoint_mgr;
     std::unique_ptr<core::module_mgr> module_mgr;
     std::unique_ptr<core::disassembly> disassembly;
+    std::unique_ptr<core::flow_graph> flow_graph;
     std::unique_ptr<core::cpu_registers> cpu_registers;
+    std::unique_ptr<core::step_engine> step_engine;
 
     std::string current_target;
     std::map<std::string, std::unique_ptr<core::target>> targets;
@@ -25,7 +25,7 @@ namespace debug::core {
       {0x0e, ' ', 1, "INC R6"},
       {0x0f, ' ', 1, "INC R7"},
       {0x10, 'R', 3, "JBC %b,%R"},
-      {0x11, 'a', 2, "ACALL %A"},
+      {0x11, 'a', 2, "ACALL %A", true},
       {0x12, 'l', 3, "LCALL %l", true},
       {0x13, ' ', 1, "RRC A"},
       {0x14, ' ', 1, "DEC A"},
@@ -267,6 +267,10 @@ namespace debug::core {
       {0, 0, 0, ""},
   };
 
+  const instruction &decode(uint8_t opcode) {
+    return instructions[opcode];
+  }
+
   void disassembly::load_file(std::string filename) {
     uint8_t data[65536];
     uint32_t start = 0, end = 0;
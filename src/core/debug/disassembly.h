@@ -16,6 +16,13 @@ namespace debug::core {
     bool is_call;
   };
 
+  /** table entry of an opcode. branch classes:
+    'A'/'a' ajmp/acall addr11, 'L'/'l' ljmp/lcall addr16, 's' sjmp rel,
+    'r' conditional rel in the 2nd byte, 'R' conditional rel in the 3rd byte,
+    '_' ret, reti or computed jump
+  */
+  const instruction &decode(uint8_t opcode);
+
   struct disassembly_line {
     disassembly_line()
         : start_addr(INVALID_ADDR)
@@ -0,0 +1,193 @@
+#include "flow_graph.h"
+
+#include <algorithm>
+
+#include "disassembly.h"
+#include "ihex.h"
+#include "log.h"
+
+namespace debug::core {
+
+  static const uint8_t OP_RET = 0x22;
+  static const uint8_t OP_RETI = 0x32;
+
+  static bool is_return(uint8_t op) {
+    return op == OP_RET || op == OP_RETI;
+  }
+
+  flow_graph::flow_graph()
+      : image_start(0)
+      , image_end(0) {
+  }
+
+  bool flow_graph::load_file(std::string filename) {
+    // ihex may place data past 64k, only the 16 bit code space is analysed
+    std::vector<char> buf(0x20000, 0xff);
+
+    uint32_t start, end;
+    if (!ihex_load_file(filename.c_str(), buf.data(), &start, &end)) {
+      clear();
+      return false;
+    }
+
+    build((const uint8_t *)buf.data(), start, std::min<ADDR>(end + 1, 0x10000));
+    log::print("flow graph: {} blocks in {:#06x}-{:#06x}\n", blocks.size(), image_start, image_end);
+    return true;
+  }
+
+  void flow_graph::build(const uint8_t *code, ADDR start, ADDR end) {
+    clear();
+
+    image.assign(0x10000, 0xff);
+    std::copy(code + start, code + end, image.begin() + start);
+    image_start = start;
+    image_end = end;
+
+    // first pass, every branch target and everything after a branch starts a block
+    std::set<ADDR> leaders{start};
+    for (ADDR addr = start; addr < end; addr += decode(image[addr]).length) {
+      const auto &instr = decode(image[addr]);
+      if (instr.branch == ' ' || instr.is_call) {
+        continue;
+      }
+
+      leaders.insert(addr + instr.length);
+      for (const auto s : successors(addr)) {
+        if (in_image(s)) {
+          leaders.insert(s);
+        }
+      }
+    }
+
+    // second pass, cut the sweep at the leaders
+    basic_block block{start, start, {}, {}, false, false};
+    for (ADDR addr = start; addr < end;) {
+      const uint8_t op = image[addr];
+      const auto &instr = decode(op);
+      const ADDR next = addr + instr.length;
+
+      if (instr.is_call) {
+        block.calls.push_back(branch_target(addr));
+      }
+
+      const bool ends = instr.branch != ' ' && !instr.is_call;
+      if (ends || leaders.count(next) || next >= end) {
+        block.end_addr = next;
+        block.successors = successors(addr);
+        block.returns = is_return(op);
+        block.indirect = instr.branch == '_' && !block.returns;
+        blocks[block.start_addr] = block;
+
+        block = basic_block{next, next, {}, {}, false, false};
+      }
+      addr = next;
+    }
+  }
+
+  void flow_graph::clear() {
+    image.clear();
+    image_start = 0;
+    image_end = 0;
+    blocks.clear();
+  }
+
+  const basic_block *flow_graph::block_at(ADDR addr) {
+    auto it = blocks.upper_bound(addr);
+    if (it == blocks.begin()) {
+      return nullptr;
+    }
+    --it;
+    if (addr >= it->second.end_addr) {
+      return nullptr;
+    }
+    return &it->second;
+  }
+
+  flow_exits flow_graph::exits(ADDR start, ADDR end) {
+    flow_exits result{{}, {}, false};
+    if (!in_image(start) || end > image_end) {
+      result.indirect = true;
+      return result;
+    }
+
+    for (ADDR addr = start; addr < end; addr += decode(image[addr]).length) {
+      const uint8_t op = image[addr];
+      if (is_return(op)) {
+        result.returns.insert(addr);
+        continue;
+      }
+      if (decode(op).branch == '_') {
+        result.indirect = true;
+        continue;
+      }
+
+      for (const auto s : successors(addr)) {
+        if (s < start || s >= end) {
+          result.addrs.insert(s);
+        }
+      }
+    }
+    return result;
+  }
+
+  bool flow_graph::is_return_site(ADDR addr, ADDR callee) {
+    // lcall is 3 bytes, acall 2
+    for (const ADDR length : {3, 2}) {
+      const ADDR call = addr - length;
+      if (!in_image(call)) {
+        continue;
+      }
+
+      const auto &instr = decode(image[call]);
+      if (instr.is_call && instr.length == length &&
+          (callee == INVALID_ADDR || branch_target(call) == callee)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<ADDR> flow_graph::successors(ADDR addr) {
+    const auto &instr = decode(image[addr]);
+    const ADDR next = addr + instr.length;
+
+    switch (instr.branch) {
+    case 'A':
+    case 'L':
+    case 's':
+      return {branch_target(addr)};
+    case 'r':
+    case 'R':
+      return {next, branch_target(addr)};
+    case '_':
+      return {};
+    default:
+      // plain instructions and calls, which come back here
+      return {next};
+    }
+  }
+
+  ADDR flow_graph::branch_target(ADDR addr) {
+    const uint8_t op = image[addr];
+    const auto &instr = decode(op);
+    const ADDR next = addr + instr.length;
+
+    switch (instr.branch) {
+    case 'A':
+    case 'a':
+      // the upper 5 bits come from the next instruction's address
+      return (next & 0xF800) | ((op & 0xE0) << 3) | image[(addr + 1) & 0xFFFF];
+    case 'L':
+    case 'l':
+      return (image[(addr + 1) & 0xFFFF] << 8) | image[(addr + 2) & 0xFFFF];
+    case 'r':
+    case 's':
+      return (next + int8_t(image[(addr + 1) & 0xFFFF])) & 0xFFFF;
+    case 'R':
+      return (next + int8_t(image[(addr + 2) & 0xFFFF])) & 0xFFFF;
+    default:
+      return INVALID_ADDR;
+    }
+  }
+
+} // namespace debug::core
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace debug::core {
+
+  /** straight line code [start_addr, end_addr), only the last instruction branches
+  */
+  struct basic_block {
+    ADDR start_addr;
+    ADDR end_addr;
+    // branch targets and the fall through, calls continue after themselves
+    std::vector<ADDR> successors;
+    // targets of the calls made from this block
+    std::vector<ADDR> calls;
+    // ends in ret or reti
+    bool returns;
+    // ends in a computed jump, the successors are unknown
+    bool indirect;
+  };
+
+  /** the ways execution can leave an address range, calls made from the
+    range return into it and are not exits
+  */
+  struct flow_exits {
+    // first addresses outside the range
+    std::set<ADDR> addrs;
+    // ret and reti inside the range, they continue at the return address
+    std::set<ADDR> returns;
+    // a computed jump leaves to somewhere unknown
+    bool indirect;
+  };
+
+  /** control flow of the firmware image, decoded once at load time
+  */
+  class flow_graph {
+  public:
+    flow_graph();
+
+    bool load_file(std::string filename);
+    void build(const uint8_t *code, ADDR start, ADDR end);
+    void clear();
+
+    bool empty() const {
+      return blocks.empty();
+    }
+
+    const basic_block *block_at(ADDR addr);
+
+    /** where execution can go from [start, end), indirect is also set if
+      the range is not inside the image
+    */
+    flow_exits exits(ADDR start, ADDR end);
+
+    /// addr follows a call to callee, any call if callee is INVALID_ADDR
+    bool is_return_site(ADDR addr, ADDR callee);
+
+    /// branch targets and the fall through of the instruction at addr
+    std::vector<ADDR> successors(ADDR addr);
+
+  protected:
+    std::vector<uint8_t> image;
+    ADDR image_start;
+    ADDR image_end;
+
+    // keyed by start address
+    std::map<ADDR, basic_block> blocks;
+
+    bool in_image(ADDR addr) const {
+      return addr >= image_start && addr < image_end;
+    }
+
+    ADDR branch_target(ADDR addr);
+  };
+
+} // namespace debug::core
@@ -0,0 +1,244 @@
+#include "mem_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace debug::core {
+
+  static const uint32_t max_fetch = 0x8000;
+
+  mem_cache::mem_cache() {
+    // sfr reads can have side effects (fifos, flags), never read ahead there
+    const policy policies[SPACE_COUNT] = {
+        {0x100, 16, 1, false},   // IRAM
+        {0x100, 1, 0, false},    // SFR
+        {0x10000, 64, 1, false}, // XDATA
+        {0x20000, 256, 1, true}, // CODE
+    };
+
+    for (int i = 0; i < SPACE_COUNT; i++) {
+      area &a = areas[i];
+      a.pol = policies[i];
+      a.data.resize(a.pol.size);
+      a.valid.assign(a.pol.size / a.pol.line_size, false);
+      a.dirty.assign(a.pol.size, false);
+      a.dirty_lo = a.pol.size;
+      a.dirty_hi = 0;
+      a.uncached_lo = 0;
+      a.uncached_hi = 0;
+      a.st = {0, 0};
+    }
+  }
+
+  mem_cache::fetch_func mem_cache::chunked(uint32_t max_len, fetch_func fetch) {
+    return [max_len, fetch](uint32_t addr, uint32_t len, uint8_t *buf) {
+      for (uint32_t offset = 0; offset < len; offset += max_len) {
+        fetch(addr + offset, std::min(len - offset, max_len), buf + offset);
+      }
+    };
+  }
+
+  void mem_cache::read(space s, uint32_t addr, uint32_t len, uint8_t *buf, const fetch_func &fetch) {
+    area &a = areas[s];
+    if (len == 0) {
+      return;
+    }
+    if (addr + len > a.pol.size) {
+      // outside of what is cached, e.g. banked code past 128k
+      a.st.misses++;
+      return fetch(addr, len, buf);
+    }
+    if (uncached(s, addr, len)) {
+      // only the requested bytes of the window, the rest through the lines
+      const uint32_t lo = std::max(addr, a.uncached_lo);
+      const uint32_t hi = std::min(addr + len, a.uncached_hi);
+      read(s, addr, lo - addr, buf, fetch);
+      a.st.misses++;
+      fetch(lo, hi - lo, buf + lo - addr);
+      return read(s, hi, addr + len - hi, buf + hi - addr, fetch);
+    }
+
+    const uint32_t line_size = a.pol.line_size;
+    const uint32_t lines = a.valid.size();
+    const uint32_t first = addr / line_size;
+    const uint32_t last = (addr + len - 1) / line_size;
+
+    // a line is good if it is valid or the requested part was written
+    const auto cached = [&](uint32_t line) {
+      const uint32_t begin = std::max(addr, line * line_size);
+      const uint32_t end = std::min(addr + len, (line + 1) * line_size);
+      return a.valid[line] || all_dirty(a, begin, end);
+    };
+
+    for (uint32_t line = first; line <= last;) {
+      if (cached(line)) {
+        a.st.hits++;
+        line++;
+        continue;
+      }
+
+      // fetch the whole run of missing lines in one go,
+      // bounded so the length fits the 16 bit target reads
+      uint32_t end = line;
+      while (end <= last && !cached(end) && (end - line) * line_size < max_fetch) {
+        end++;
+      }
+      a.st.misses += end - line;
+
+      if (end > last) {
+        for (uint32_t n = 0; n < a.pol.read_ahead && end < lines && !a.valid[end] && !uncached(s, end * line_size, line_size); n++) {
+          end++;
+        }
+      }
+
+      // buffered writes are newer than what the target holds
+      const uint32_t begin = line * line_size;
+      std::vector<uint8_t> fetched((end - line) * line_size);
+      fetch(begin, fetched.size(), fetched.data());
+      for (uint32_t i = 0; i < fetched.size(); i++) {
+        if (!a.dirty[begin + i]) {
+          a.data[begin + i] = fetched[i];
+        }
+      }
+
+      std::fill(a.valid.begin() + line, a.valid.begin() + end, true);
+      line = end;
+    }
+
+    memcpy(buf, a.data.data() + addr, len);
+  }
+
+  void mem_cache::write(space s, uint32_t addr, uint32_t len, const uint8_t *buf) {
+    area &a = areas[s];
+    if (len == 0 || addr + len > a.pol.size) {
+      return;
+    }
+
+    memcpy(a.data.data() + addr, buf, len);
+    std::fill(a.dirty.begin() + addr, a.dirty.begin() + addr + len, true);
+    a.dirty_lo = std::min(a.dirty_lo, addr);
+    a.dirty_hi = std::max(a.dirty_hi, addr + len - 1);
+  }
+
+  void mem_cache::flush(space s, const flush_func &flush) {
+    area &a = areas[s];
+
+    // short clean gaps are written along if their value is known,
+    // one transfer is cheaper than two
+    const uint32_t max_gap = 8;
+
+    uint32_t addr = a.dirty_lo;
+    while (addr <= a.dirty_hi) {
+      if (!a.dirty[addr]) {
+        addr++;
+        continue;
+      }
+
+      uint32_t end = addr;
+      while (true) {
+        while (end <= a.dirty_hi && a.dirty[end]) {
+          end++;
+        }
+
+        uint32_t next = end;
+        while (next <= a.dirty_hi && !a.dirty[next] && a.valid[next / a.pol.line_size] && next - end < max_gap) {
+          next++;
+        }
+        if (next > a.dirty_hi || !a.dirty[next]) {
+          break;
+        }
+        end = next;
+      }
+
+      flush(addr, end - addr, a.data.data() + addr);
+      addr = end;
+    }
+
+    clear_dirty(a, 0, a.pol.size);
+  }
+
+  bool mem_cache::dirty(space s) const {
+    return areas[s].dirty_lo <= areas[s].dirty_hi;
+  }
+
+  void mem_cache::invalidate() {
+    for (auto &a : areas) {
+      if (!a.pol.persistent) {
+        std::fill(a.valid.begin(), a.valid.end(), false);
+        clear_dirty(a, 0, a.pol.size);
+      }
+    }
+  }
+
+  void mem_cache::invalidate(space s, uint32_t addr, uint32_t len) {
+    area &a = areas[s];
+    if (len == 0 || addr >= a.pol.size) {
+      return;
+    }
+
+    const uint32_t first = addr / a.pol.line_size;
+    const uint32_t last = std::min<uint32_t>((addr + len - 1) / a.pol.line_size, a.valid.size() - 1);
+    std::fill(a.valid.begin() + first, a.valid.begin() + last + 1, false);
+    clear_dirty(a, addr, std::min(addr + len, a.pol.size));
+  }
+
+  void mem_cache::set_uncached(space s, uint32_t addr, uint32_t len) {
+    area &a = areas[s];
+    const uint32_t line_size = a.pol.line_size;
+    a.uncached_lo = std::min(addr / line_size * line_size, a.pol.size);
+    a.uncached_hi = std::min((addr + len + line_size - 1) / line_size * line_size, a.pol.size);
+    invalidate(s, a.uncached_lo, a.uncached_hi - a.uncached_lo);
+  }
+
+  bool mem_cache::uncached(space s, uint32_t addr, uint32_t len) const {
+    const area &a = areas[s];
+    return addr < a.uncached_hi && addr + len > a.uncached_lo;
+  }
+
+  bool mem_cache::all_dirty(const area &a, uint32_t begin, uint32_t end) {
+    if (begin < a.dirty_lo || end - 1 > a.dirty_hi) {
+      return false;
+    }
+    for (uint32_t i = begin; i < end; i++) {
+      if (!a.dirty[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void mem_cache::clear_dirty(area &a, uint32_t begin, uint32_t end) {
+    if (a.dirty_lo > a.dirty_hi) {
+      return;
+    }
+
+    begin = std::max(begin, a.dirty_lo);
+    end = std::min(end, a.dirty_hi + 1);
+    if (begin < end) {
+      std::fill(a.dirty.begin() + begin, a.dirty.begin() + end, false);
+    }
+
+    // shrink the bounds to what is left
+    while (a.dirty_lo <= a.dirty_hi && !a.dirty[a.dirty_lo]) {
+      a.dirty_lo++;
+    }
+    while (a.dirty_hi >= a.dirty_lo && a.dirty_hi > 0 && !a.dirty[a.dirty_hi]) {
+      a.dirty_hi--;
+    }
+    if (a.dirty_lo > a.dirty_hi) {
+      a.dirty_lo = a.pol.size;
+      a.dirty_hi = 0;
+    }
+  }
+
+  mem_cache::stats mem_cache::get_stats(space s) const {
+    return areas[s].st;
+  }
+
+  void mem_cache::reset_stats() {
+    for (auto &a : areas) {
+      a.st = {0, 0};
+    }
+  }
+
+} // namespace debug::core
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace debug::core {
+
+  /** Line based cache of target memory, filled while the target is halted.
+    Every space has its own line size and read-ahead. Code lines survive
+    running the target, flash only changes through write_code.
+    Writes can be held back as dirty bytes, reads see them right away
+    and flush() hands them to the target in as few transfers as possible.
+  */
+  class mem_cache {
+  public:
+    enum space {
+      IRAM,
+      SFR,
+      XDATA,
+      CODE,
+      SPACE_COUNT,
+    };
+
+    struct stats {
+      uint64_t hits;
+      uint64_t misses;
+    };
+
+    // reads len bytes starting at addr from the target, always whole lines
+    typedef std::function<void(uint32_t addr, uint32_t len, uint8_t *buf)> fetch_func;
+    // writes len bytes starting at addr to the target
+    typedef std::function<void(uint32_t addr, uint32_t len, uint8_t *buf)> flush_func;
+
+    mem_cache();
+
+    /// fetch in pieces of at most max_len bytes, for reads with 8 bit lengths
+    static fetch_func chunked(uint32_t max_len, fetch_func fetch);
+
+    void read(space s, uint32_t addr, uint32_t len, uint8_t *buf, const fetch_func &fetch);
+
+    /// buffer a write until the next flush
+    void write(space s, uint32_t addr, uint32_t len, const uint8_t *buf);
+    /// write back buffered bytes, adjacent runs are merged
+    void flush(space s, const flush_func &flush);
+    bool dirty(space s) const;
+
+    /// drop every line that may change while the target runs, buffered writes included
+    void invalidate();
+    /// drop the lines covering a range, after it was written on the target
+    void invalidate(space s, uint32_t addr, uint32_t len);
+
+    /** never cache, read ahead into or buffer writes to a range, for
+      registers mapped into a space whose reads have side effects.
+      widened to whole lines, one range per space.
+    */
+    void set_uncached(space s, uint32_t addr, uint32_t len);
+    bool uncached(space s, uint32_t addr, uint32_t len) const;
+
+    stats get_stats(space s) const;
+    void reset_stats();
+
+  private:
+    struct policy {
+      uint32_t size;
+      uint32_t line_size;
+      uint32_t read_ahead; // lines fetched past the end of a miss
+      bool persistent;     // kept when the target runs
+    };
+
+    struct area {
+      policy pol;
+      std::vector<uint8_t> data;
+      std::vector<bool> valid;
+      std::vector<bool> dirty;
+      // bounds of the dirty bytes, empty if lo > hi
+      uint32_t dirty_lo;
+      uint32_t dirty_hi;
+      // uncached window, empty if lo >= hi
+      uint32_t uncached_lo;
+      uint32_t uncached_hi;
+      stats st;
+    };
+
+    std::array<area, SPACE_COUNT> areas;
+
+    static bool all_dirty(const area &a, uint32_t begin, uint32_t end);
+    static void clear_dirty(area &a, uint32_t begin, uint32_t end);
+  };
+
+} // namespace debug::core
@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <fstream>
+#include <iterator>
 
 #include <string>
 
@@ -143,6 +144,12 @@ namespace debug::core {
     return INVALID_LINE;
   }
 
+  void module::get_c_bounds(ADDR addr, ADDR &start, ADDR &end) {
+    const auto it = c_addr_map.upper_bound(addr);
+    end = it != c_addr_map.end() ? it->first : INVALID_ADDR;
+    start = it != c_addr_map.begin() ? std::prev(it)->first : INVALID_ADDR;
+  }
+
   void module_mgr::reset() {
     module_map.clear();
   }
@@ -184,6 +191,23 @@ namespace debug::core {
     return false;
   }
 
+  bool module_mgr::get_c_range(ADDR addr, ADDR &start, ADDR &end) {
+    // modules share the code space, the closest bounds of any module win
+    start = INVALID_ADDR;
+    end = INVALID_ADDR;
+    for (auto &m : module_map) {
+      ADDR s, e;
+      m.second.get_c_bounds(addr, s, e);
+      if (s != INVALID_ADDR && (start == INVALID_ADDR || s > start)) {
+        start = s;
+      }
+      if (e != INVALID_ADDR && (end == INVALID_ADDR || e < end)) {
+        end = e;
+      }
+    }
+    return start != INVALID_ADDR;
+  }
+
   bool module_mgr::get_c_addr(ADDR addr, std::string &module, LINE_NUM &line) {
     for (auto it = module_map.begin(); it != module_map.end(); ++it) {
       line = it->second.get_c_line(addr);
@@ -42,6 +42,9 @@ namespace debug::core {
     LINE_NUM get_c_line(ADDR addr);
     LINE_NUM get_asm_line(ADDR addr);
 
+    // closest c line start at or before addr and the next one after it, INVALID_ADDR if none
+    void get_c_bounds(ADDR addr, ADDR &start, ADDR &end);
+
     uint32_t get_c_block(uint32_t line);
     uint32_t get_c_level(uint32_t line);
 
@@ -90,6 +93,11 @@ namespace debug::core {
     bool get_asm_addr(ADDR addr, std::string &module, LINE_NUM &line);
     bool get_c_addr(ADDR addr, std::string &module, LINE_NUM &line);
 
+    /** address range [start, end) of the c line containing addr, end is
+      INVALID_ADDR if no line follows
+    */
+    bool get_c_range(ADDR addr, ADDR &start, ADDR &end);
+
   protected:
     std::map<std::string, debug::core::module> module_map;
   };
@@ -31,20 +31,46 @@ namespace debug::core {
   cpu_registers::cpu_registers(dbg_session *session)
       : session(session) {}
 
-  uint8_t cpu_registers::read(cpu_register_names name) {
-    target_addr addr = {};
+  target_addr cpu_registers::addr(cpu_register_names name) {
     if (name <= R7) {
-      addr.space = target_addr::AS_REGISTER;
-      addr.addr = registers[name].addr;
-    } else {
-      addr.space = target_addr::AS_SFR;
-      addr.addr = registers[name].addr;
+      return {target_addr::AS_REGISTER, registers[name].addr};
     }
+    return {target_addr::AS_SFR, registers[name].addr};
+  }
+
+  uint8_t cpu_registers::read(cpu_register_names name) {
     uint8_t value = 0;
-    session->target()->read_memory(addr, 1, &value);
+    session->target()->read_memory(addr(name), 1, &value);
     return value;
   }
 
+  uint8_t cpu_registers::get(const cpu_state &state, cpu_register_names name) {
+    switch (name) {
+    case SP:
+      return state.sp;
+    case DPL0:
+      return state.dpl0;
+    case DPH0:
+      return state.dph0;
+    case DPL1:
+      return state.dpl1;
+    case DPH1:
+      return state.dph1;
+    case DPS:
+      return state.dps;
+    case PSW:
+      return state.psw;
+    case ACC:
+      return state.acc;
+    default:
+      return state.r[name - R0];
+    }
+  }
+
+  std::string cpu_registers::print(const cpu_state &state, cpu_register_names name) {
+    return fmt::format("{:#x}", get(state, name));
+  }
+
   std::string cpu_registers::print(cpu_register_names name) {
     return fmt::format("{:#x}", read(name));
   }
@@ -5,6 +5,7 @@
 #include "types.h"
 
 #include "dbg_session.h"
+#include "target.h"
 
 namespace debug::core {
 
@@ -43,12 +44,18 @@ namespace debug::core {
     std::string print(cpu_register_names name);
     uint8_t read(cpu_register_names name);
 
+    // value of a register in a snapshot from target::read_cpu_state
+    static uint8_t get(const cpu_state &state, cpu_register_names name);
+    std::string print(const cpu_state &state, cpu_register_names name);
+
     const std::vector<cpu_register> &get_registers() {
       return registers;
     }
 
   private:
     static const std::vector<cpu_register> registers;
+    static target_addr addr(cpu_register_names name);
+
     dbg_session *session;
   };
 
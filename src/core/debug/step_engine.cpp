@@ -0,0 +1,342 @@
+#include "step_engine.h"
+
+#include <string>
+#include <vector>
+
+#include "breakpoint_mgr.h"
+#include "disassembly.h"
+#include "flow_graph.h"
+#include "log.h"
+#include "module.h"
+#include "registers.h"
+#include "sym_tab.h"
+#include "target.h"
+
+namespace debug::core {
+
+  // bytes below SP searched for the return address
+  static const uint8_t RETURN_SEARCH_DEPTH = 32;
+
+  step_engine::step_engine(dbg_session *session)
+      : session(session) {
+  }
+
+  ADDR step_engine::next() {
+    target *t = session->target();
+
+    ADDR pc = t->read_PC();
+    ADDR start, end;
+    if (!line_range(pc, start, end)) {
+      // no source here, behave like nexti
+      return next_instr();
+    }
+
+    while (!t->check_stop_forced()) {
+      const run_result result = run_to_exit(start, end, pc);
+      if (result == RUN_STOPPED) {
+        return pc;
+      }
+
+      if (result == RUN_UNSUPPORTED) {
+        const uint8_t length = call_length(pc);
+        if (length) {
+          if (!step_over_call(pc, length)) {
+            // a breakpoint in the callee or a stop request
+            return t->read_PC();
+          }
+          pc += length;
+        } else {
+          pc = t->step();
+        }
+      }
+
+      if (pc >= start && pc < end) {
+        continue;
+      }
+
+      std::string module;
+      LINE_NUM line;
+      if (session->modulemgr()->get_c_addr(pc, module, line)) {
+        break;
+      }
+
+      // returned into the middle of the callers line, finish that one too
+      if (!line_range(pc, start, end)) {
+        break;
+      }
+    }
+    return pc;
+  }
+
+  ADDR step_engine::next_instr(uint32_t count) {
+    target *t = session->target();
+
+    ADDR pc = t->read_PC();
+    while (count > 0 && !t->check_stop_forced()) {
+      const uint8_t length = call_length(pc);
+      if (length) {
+        if (!step_over_call(pc, length)) {
+          return t->read_PC();
+        }
+        pc += length;
+        count--;
+        continue;
+      }
+
+      const uint32_t n = straight_run(pc, count);
+      pc = t->step(n);
+      count -= n;
+    }
+    return pc;
+  }
+
+  bool step_engine::line_range(ADDR addr, ADDR &start, ADDR &end) {
+    if (!session->modulemgr()->get_c_range(addr, start, end)) {
+      return false;
+    }
+
+    // the last line of a function ends with the function
+    std::string file, function;
+    int32_t fn_start, fn_end;
+    if (session->symtab()->get_c_function(addr, file, function) &&
+        session->symtab()->get_addr(function, fn_start, fn_end) &&
+        (end == INVALID_ADDR || fn_end + 1 < end)) {
+      end = fn_end + 1;
+    }
+
+    if (end == INVALID_ADDR) {
+      end = addr + 1;
+    }
+    return true;
+  }
+
+  uint8_t step_engine::call_length(ADDR addr) {
+    uint8_t op = 0;
+    session->target()->read_memory({target_addr::AS_CODE, addr}, 1, &op);
+
+    if (op == 0x12) {
+      return 3; // LCALL addr16
+    }
+    if ((op & 0x1F) == 0x11) {
+      return 2; // ACALL addr11
+    }
+    return 0;
+  }
+
+  uint32_t step_engine::straight_run(ADDR addr, uint32_t max) {
+    uint32_t n = 0;
+    while (n < max) {
+      uint8_t op = 0;
+      session->target()->read_memory({target_addr::AS_CODE, addr}, 1, &op);
+
+      const auto &instr = decode(op);
+      if (instr.is_call) {
+        break;
+      }
+      n++;
+      if (instr.branch != ' ') {
+        break;
+      }
+      addr += instr.length;
+    }
+    return n;
+  }
+
+  bool step_engine::step_over_call(ADDR addr, uint8_t length) {
+    target *t = session->target();
+
+    const ADDR ret = addr + length;
+    const uint8_t sp = session->regs()->read(SP);
+
+    if (!session->bpmgr()->add_step_bp(ret)) {
+      // out of hardware breakpoints, walk through the callee
+      ADDR pc;
+      do {
+        pc = t->step();
+      } while ((pc != ret || session->regs()->read(SP) > sp) && !t->check_stop_forced());
+      return pc == ret;
+    }
+
+    ADDR pc;
+    do {
+      session->bpmgr()->run_to_bp();
+      pc = t->read_PC();
+      // a recursive call returned to the same address, keep going
+    } while (pc == ret && session->regs()->read(SP) > sp);
+
+    session->bpmgr()->clear_step_bps();
+    return pc == ret;
+  }
+
+  step_engine::run_result step_engine::run_to_exit(ADDR start, ADDR end, ADDR &pc) {
+    target *t = session->target();
+    if (session->flowgraph()->empty()) {
+      return RUN_UNSUPPORTED;
+    }
+
+    const flow_exits exits = session->flowgraph()->exits(start, end);
+    if (exits.indirect || exits.returns.count(pc)) {
+      // nowhere to put the breakpoints, or a single ret is cheaper to step
+      return RUN_UNSUPPORTED;
+    }
+
+    bool placed = true;
+    for (const auto addr : exits.addrs) {
+      placed = placed && session->bpmgr()->add_step_bp(addr);
+    }
+    for (const auto addr : exits.returns) {
+      placed = placed && session->bpmgr()->add_step_bp(addr);
+    }
+
+    run_result result = RUN_UNSUPPORTED;
+    if (placed) {
+      const uint8_t sp = session->regs()->read(SP);
+      while (true) {
+        session->bpmgr()->run_to_bp();
+        pc = t->read_PC();
+
+        const bool is_exit = exits.addrs.count(pc) || exits.returns.count(pc);
+        if (!is_exit) {
+          result = RUN_STOPPED;
+          break;
+        }
+        // a deeper sp means a call from the range reached the exit, keep going
+        if (session->regs()->read(SP) <= sp) {
+          result = RUN_EXITED;
+          break;
+        }
+      }
+    }
+
+    session->bpmgr()->clear_step_bps();
+
+    if (result == RUN_EXITED && exits.returns.count(pc)) {
+      // execute the ret to land in the caller
+      pc = t->step();
+    }
+    return result;
+  }
+
+  ADDR step_engine::until() {
+    target *t = session->target();
+
+    const ADDR start = t->read_PC();
+    std::string file, function;
+    session->symtab()->get_c_function(start, file, function);
+
+    ADDR pc = next();
+    while (pc < start && !t->check_stop_forced()) {
+      std::string new_function;
+      if (!session->symtab()->get_c_function(pc, file, new_function) || new_function != function) {
+        break;
+      }
+      pc = next();
+    }
+    return pc;
+  }
+
+  ADDR step_engine::finish() {
+    return run_to(INVALID_ADDR, false);
+  }
+
+  ADDR step_engine::run_to(ADDR location, bool frame_only) {
+    target *t = session->target();
+
+    ADDR ret;
+    uint8_t ret_sp;
+    const bool has_return = return_address(ret, ret_sp);
+    if (!has_return && location == INVALID_ADDR) {
+      log::print("Can not find the return address of the current function\n");
+      return t->read_PC();
+    }
+
+    const uint8_t sp = session->regs()->read(SP);
+    auto reached = [&](ADDR pc) {
+      const uint8_t now = session->regs()->read(SP);
+      if (has_return && pc == ret && now <= ret_sp) {
+        return true;
+      }
+      // a recursive call pushes at least its return address
+      return pc == location && (!frame_only || now < sp + 2);
+    };
+
+    bool placed = true;
+    if (location != INVALID_ADDR) {
+      placed = session->bpmgr()->add_step_bp(location);
+    }
+    if (has_return) {
+      placed = placed && session->bpmgr()->add_step_bp(ret);
+    }
+
+    ADDR pc;
+    if (!placed) {
+      session->bpmgr()->clear_step_bps();
+
+      // out of hardware breakpoints, step there
+      do {
+        pc = t->step();
+      } while (!reached(pc) && !t->check_stop_forced());
+      return pc;
+    }
+
+    while (true) {
+      session->bpmgr()->run_to_bp();
+      pc = t->read_PC();
+      if (reached(pc) || (pc != location && pc != ret)) {
+        // arrived, or a user breakpoint or stop request
+        break;
+      }
+    }
+
+    session->bpmgr()->clear_step_bps();
+    return pc;
+  }
+
+  bool step_engine::return_address(ADDR &ret, uint8_t &ret_sp) {
+    const ADDR pc = session->target()->read_PC();
+    const uint8_t sp = session->regs()->read(SP);
+    if (sp < 1) {
+      return false;
+    }
+
+    ADDR callee = INVALID_ADDR;
+    std::string file, function;
+    int32_t fn_start, fn_end;
+    if (session->symtab()->get_c_function(pc, file, function) &&
+        session->symtab()->get_addr(function, fn_start, fn_end)) {
+      callee = fn_start;
+    }
+
+    // lcall pushes the low byte first, the high byte sits at SP on entry
+    flow_graph *graph = session->flowgraph();
+    if (graph->empty()) {
+      uint8_t buf[2];
+      session->target()->read_memory({target_addr::AS_ISTACK, ADDR(sp - 1)}, 2, buf);
+      ret = buf[0] | (buf[1] << 8);
+      ret_sp = sp - 2;
+      return true;
+    }
+
+    // the function may have pushed more since, look for the newest
+    // address that follows a call of it
+    const uint8_t depth = sp < RETURN_SEARCH_DEPTH ? sp : RETURN_SEARCH_DEPTH;
+    uint8_t stack[RETURN_SEARCH_DEPTH + 1];
+    session->target()->read_memory({target_addr::AS_ISTACK, ADDR(sp - depth)}, depth + 1, stack);
+
+    auto search = [&](ADDR fn) {
+      for (ADDR top = depth; top >= 1; top--) {
+        const ADDR candidate = stack[top - 1] | (stack[top] << 8);
+        if (graph->is_return_site(candidate, fn)) {
+          ret = candidate;
+          ret_sp = sp - (depth - top) - 2;
+          return true;
+        }
+      }
+      return false;
+    };
+
+    // called through a pointer the call does not name the function
+    return search(callee) || (callee != INVALID_ADDR && search(INVALID_ADDR));
+  }
+
+} // namespace debug::core
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "dbg_session.h"
+#include "types.h"
+
+namespace debug::core {
+
+  /** Source level stepping on top of the target primitives.
+    With a flow graph of the image the exits of the current line get temporary
+    breakpoints and the target runs at full speed. Without one, or with more
+    exits than free breakpoints, only the instructions of the line are single
+    stepped and calls are run through with a breakpoint on their return address.
+  */
+  class step_engine {
+  public:
+    step_engine(dbg_session *session);
+
+    /// run to the start of the next line, calls are stepped over
+    ADDR next();
+    /// execute count instructions, calls are stepped over and count as one
+    ADDR next_instr(uint32_t count = 1);
+    /// like next, but a jump back in a loop keeps going until a later line
+    ADDR until();
+
+    /// run until the current function returned to its caller
+    ADDR finish();
+    /** run to location or until the current function returned. with
+      frame_only a deeper call of the current function does not stop at
+      location (until), otherwise any arrival does (advance).
+    */
+    ADDR run_to(ADDR location, bool frame_only);
+
+  protected:
+    enum run_result {
+      // the exits can not be covered with breakpoints
+      RUN_UNSUPPORTED,
+      // pc is the first address outside the range
+      RUN_EXITED,
+      // stopped elsewhere, by a user breakpoint or a stop request
+      RUN_STOPPED,
+    };
+
+    dbg_session *session;
+
+    bool line_range(ADDR addr, ADDR &start, ADDR &end);
+
+    // length of the call instruction at addr, 0 if it is no call
+    uint8_t call_length(ADDR addr);
+    // instructions from addr that can be stepped at once, up to the next call or after a branch
+    uint32_t straight_run(ADDR addr, uint32_t max);
+    // run the call at addr until it returned, false if the cpu stopped elsewhere
+    bool step_over_call(ADDR addr, uint8_t length);
+    // run until execution leaves [start, end) at the current stack level
+    run_result run_to_exit(ADDR start, ADDR end, ADDR &pc);
+
+    /** return address of the current function from the internal stack and
+      the SP once it returned, false if none is found
+    */
+    bool return_address(ADDR &ret, uint8_t &ret_sp);
+  };
+
+} // namespace debug::core
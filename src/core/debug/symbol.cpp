@@ -9,6 +9,7 @@
 #include "log.h"
 #include "mem_remap.h"
 #include "sym_type_tree.h"
+#include "target.h"
 
 namespace debug::core {
 
@@ -103,6 +104,15 @@ namespace debug::core {
   /** Recursive function to print out an complete arrays contents.
 */
   void symbol::print_array(char format, int dim_num, target_addr addr, sym_type *type) {
+    if (dim_num == 0) {
+      // one read for the whole array instead of one per element
+      uint32_t count = 1;
+      for (auto size : m_array_size) {
+        count *= size;
+      }
+      session->target()->read_memory_v({{addr, count * type->size(), nullptr}});
+    }
+
     if (dim_num == (m_array_size.size() - 1)) {
       // special case default format with char array
       if (format == 0 && (type->name() == "char" || type->name() == "unsigned char")) {
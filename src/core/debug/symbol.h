@@ -152,8 +152,10 @@ namespace debug::core {
     void set_end_addr(target_addr addr);
 
     void set_length(int len);
+    int length() { return m_length; }
 
     void add_reg(std::string reg) { m_regs.push_back(reg); }
+    const std::list<std::string> &regs() { return m_regs; }
 
     uint32_t array_size() { return m_array_size[0]; }
     void add_array_size(uint32_t size) { m_array_size.push_back(size); }
@@ -1,7 +1,10 @@
 #include "target.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <vector>
 
 #include "ihex.h"
 #include "log.h"
@@ -9,7 +12,8 @@
 namespace debug::core {
 
   target::target()
-      : force_stop(false) {
+      : force_stop(false)
+      , syncing(false) {
   }
 
   target::~target() {
@@ -34,32 +38,42 @@ namespace debug::core {
     }
   }
 
+  static void log_transfer(const char *what, uint32_t size, std::chrono::steady_clock::time_point begin) {
+    const auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    log::print("{} {} bytes in {:.1f} ms ({:.2f} KB/s)\n", what, size, secs * 1000, secs > 0 ? size / secs / 1024 : 0.0);
+  }
+
   /** Default implementation, load an intel hex file and use write_code to place
 	it in memory
 */
   bool target::load_file(std::string name) {
     // set all data to 0xff, since this is the default erased value for flash
-    char buf[0x20000];
-    memset(buf, 0xff, 0x20000);
+    std::vector<char> buf(0x20000, 0xff);
 
     log::print("Loading file '{}'\n", name);
 
     uint32_t start, end;
-    if (!ihex_load_file(name.c_str(), buf, &start, &end)) {
+    if (!ihex_load_file(name.c_str(), buf.data(), &start, &end)) {
       return false;
     }
 
-    print_buf_dump(buf, end - start);
+    print_buf_dump(buf.data(), end - start);
     log::printf("start %d %d\n", start, end);
 
     const uint32_t size = end - start + 1;
+
+    auto begin = std::chrono::steady_clock::now();
     write_code(start, end - start + 1, (uint8_t *)&buf[start]);
+    log_transfer("written", size, begin);
 
-    char verify[size];
-    read_code(start, size, (uint8_t *)verify);
+    std::vector<char> verify(size);
+    begin = std::chrono::steady_clock::now();
+    read_code(start, size, (uint8_t *)verify.data());
+    log_transfer("verified", size, begin);
 
     for (size_t i = 0; i < size; i++) {
       if (buf[start + i] != verify[i]) {
+        log::print("verify failed at {:#06x}\n", start + i);
         return false;
       }
     }
@@ -83,68 +97,228 @@ namespace debug::core {
   /** derived calsses must call this function to ensure the cache is updated.
 */
   void target::write_sfr(uint8_t addr,
-                         uint8_t page,
+                         uint8_t,
                          uint8_t len,
-                         unsigned char *buf) {
-    SFR_PAGE_LIST::iterator it;
-    it = cache_get_sfr_page(page);
-
-    if (it != mCacheSfrPages.end()) {
-      // update values in cache
-      memcpy((*it).buf + (addr - 0x80), buf, len);
-    }
+                         unsigned char *) {
+    invalidate_cache(mem_cache::SFR, addr, len);
   }
 
   void target::invalidate_cache() {
-    mCacheSfrPages.clear();
-  }
-
-  void target::read_sfr_cache(uint8_t addr,
-                              uint8_t page,
-                              uint8_t len,
-                              unsigned char *buf) {
-    SFR_PAGE_LIST::iterator it;
-    it = cache_get_sfr_page(page);
-
-    if (it == mCacheSfrPages.end()) {
-      // not in cache, read it and cache it.
-      SFR_CACHE_PAGE page_entry;
-      page_entry.page = page;
-      read_sfr(0x80, page_entry.page, 128, page_entry.buf);
-      mCacheSfrPages.push_back(page_entry);
-      memcpy(buf, page_entry.buf + (addr - 0x80), len);
-    } else {
-      // in cache
-      memcpy(buf, (*it).buf + (addr - 0x80), len);
+    sync();
+    _cache.invalidate();
+  }
+
+  void target::invalidate_cache(mem_cache::space space, uint32_t addr, uint32_t len) {
+    if (syncing) {
+      return;
     }
+    _cache.invalidate(space, addr, len);
+  }
+
+  void target::drop_cache() {
+    _cache.invalidate();
+    _cache.invalidate(mem_cache::CODE, 0, 0x20000);
+  }
+
+  void target::set_uncached(mem_cache::space space, uint32_t addr, uint32_t len) {
+    _cache.set_uncached(space, addr, len);
   }
 
   void target::read_memory(target_addr addr, int len, uint8_t *buf) {
     switch (addr.space) {
     case target_addr::AS_CODE:
     case target_addr::AS_CODE_STATIC:
-      return read_code(addr.addr, len, buf);
+      return _cache.read(mem_cache::CODE, addr.addr, len, buf, [this](uint32_t a, uint32_t n, uint8_t *data) {
+        read_code(a, n, data);
+      });
 
     case target_addr::AS_ISTACK:
     case target_addr::AS_IRAM_LOW:
     case target_addr::AS_INT_RAM:
-      return read_data(addr.addr, len, buf);
+      // read_data takes 8 bit lengths, a line fetch can be the whole 256 bytes
+      return _cache.read(mem_cache::IRAM, addr.addr, len, buf, mem_cache::chunked(0x80, [this](uint32_t a, uint32_t n, uint8_t *data) {
+                           read_data(a, n, data);
+                         }));
 
     case target_addr::AS_XSTACK:
     case target_addr::AS_EXT_RAM:
-      return read_xdata(addr.addr, len, buf);
+      return _cache.read(mem_cache::XDATA, addr.addr, len, buf, [this](uint32_t a, uint32_t n, uint8_t *data) {
+        read_xdata(a, n, data);
+      });
 
     case target_addr::AS_SFR:
-      return read_sfr(addr.addr, len, buf);
+      return _cache.read(mem_cache::SFR, addr.addr, len, buf, mem_cache::chunked(0x80, [this](uint32_t a, uint32_t n, uint8_t *data) {
+                           read_sfr(a, n, data);
+                         }));
 
     case target_addr::AS_REGISTER: {
       uint8_t offset = 0;
-      read_sfr(0xd0, 1, &offset);
-      return read_data(addr.addr + (offset & 0x18), len, buf);
+      read_memory({target_addr::AS_SFR, 0xd0}, 1, &offset);
+      return read_memory({target_addr::AS_INT_RAM, addr.addr + (offset & 0x18)}, len, buf);
     }
 
     default:
       break;
     }
   }
-} // namespace debug::core
\ No newline at end of file
+
+  // cache space backing a target address space, SPACE_COUNT if not cached
+  static mem_cache::space cache_space(target_addr::target_addr_space space) {
+    switch (space) {
+    case target_addr::AS_CODE:
+    case target_addr::AS_CODE_STATIC:
+      return mem_cache::CODE;
+    case target_addr::AS_ISTACK:
+    case target_addr::AS_IRAM_LOW:
+    case target_addr::AS_INT_RAM:
+      return mem_cache::IRAM;
+    case target_addr::AS_XSTACK:
+    case target_addr::AS_EXT_RAM:
+      return mem_cache::XDATA;
+    case target_addr::AS_SFR:
+      return mem_cache::SFR;
+    default:
+      return mem_cache::SPACE_COUNT;
+    }
+  }
+
+  void target::read_memory_v(std::vector<mem_range> ranges) {
+    // registers are plain iram once the bank is known, so they merge with it
+    int psw = -1;
+    for (auto &r : ranges) {
+      if (r.addr.space != target_addr::AS_REGISTER) {
+        continue;
+      }
+      if (psw < 0) {
+        uint8_t val = 0;
+        read_memory({target_addr::AS_SFR, 0xd0}, 1, &val);
+        psw = val;
+      }
+      r.addr = {target_addr::AS_INT_RAM, r.addr.addr + (psw & 0x18)};
+    }
+
+    ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](mem_range &r) {
+                   return r.len == 0 || !r.addr.valid() || cache_space(r.addr.space) == mem_cache::SPACE_COUNT;
+                 }),
+                 ranges.end());
+
+    std::sort(ranges.begin(), ranges.end(), [](const mem_range &a, const mem_range &b) {
+      const auto sa = cache_space(a.addr.space);
+      const auto sb = cache_space(b.addr.space);
+      return sa != sb ? sa < sb : a.addr.addr < b.addr.addr;
+    });
+
+    std::vector<uint8_t> run;
+    for (size_t first = 0; first < ranges.size();) {
+      const auto space = cache_space(ranges[first].addr.space);
+      const uint32_t begin = ranges[first].addr.addr;
+      uint32_t end = begin + ranges[first].len;
+
+      size_t last = first + 1;
+      while (last < ranges.size() && cache_space(ranges[last].addr.space) == space) {
+        // valid addresses are never negative
+        const uint32_t addr = ranges[last].addr.addr;
+        if (addr > end) {
+          break;
+        }
+        end = std::max(end, addr + ranges[last].len);
+        last++;
+      }
+
+      run.resize(end - begin);
+      read_memory(ranges[first].addr, run.size(), run.data());
+
+      for (size_t i = first; i < last; i++) {
+        if (ranges[i].buf) {
+          memcpy(ranges[i].buf, run.data() + ranges[i].addr.addr - begin, ranges[i].len);
+        }
+      }
+      first = last;
+    }
+  }
+
+  uint16_t target::step(uint32_t count) {
+    uint16_t pc = read_PC();
+    for (uint32_t i = 0; i < count && !check_stop_forced(); i++) {
+      pc = step();
+    }
+    return pc;
+  }
+
+  cpu_state target::read_cpu_state() {
+    cpu_state state;
+    read_memory_v({
+        {{target_addr::AS_REGISTER, 0x00}, 8, state.r},
+        {{target_addr::AS_SFR, 0x81}, 1, &state.sp},
+        {{target_addr::AS_SFR, 0x82}, 1, &state.dpl0},
+        {{target_addr::AS_SFR, 0x83}, 1, &state.dph0},
+        {{target_addr::AS_SFR, 0x84}, 1, &state.dpl1},
+        {{target_addr::AS_SFR, 0x85}, 1, &state.dph1},
+        {{target_addr::AS_SFR, 0x92}, 1, &state.dps},
+        {{target_addr::AS_SFR, 0xd0}, 1, &state.psw},
+        {{target_addr::AS_SFR, 0xe0}, 1, &state.acc},
+        {{target_addr::AS_SFR, 0xf0}, 1, &state.b},
+    });
+    state.pc = read_PC();
+    return state;
+  }
+
+  void target::write_memory(target_addr addr, int len, uint8_t *buf) {
+    switch (addr.space) {
+    case target_addr::AS_CODE:
+    case target_addr::AS_CODE_STATIC:
+      return write_code(addr.addr, len, buf);
+
+    case target_addr::AS_ISTACK:
+    case target_addr::AS_IRAM_LOW:
+    case target_addr::AS_INT_RAM:
+      return _cache.write(mem_cache::IRAM, addr.addr, len, buf);
+
+    case target_addr::AS_XSTACK:
+    case target_addr::AS_EXT_RAM:
+      if (_cache.uncached(mem_cache::XDATA, addr.addr, len)) {
+        // registers, keep the order of the writes
+        sync();
+        return write_xdata(addr.addr, len, buf);
+      }
+      return _cache.write(mem_cache::XDATA, addr.addr, len, buf);
+
+    case target_addr::AS_SFR:
+      // may act on buffered data, e.g. a dma trigger, write that first
+      sync();
+      return write_sfr(addr.addr, len, buf);
+
+    case target_addr::AS_REGISTER: {
+      uint8_t offset = 0;
+      read_memory({target_addr::AS_SFR, 0xd0}, 1, &offset);
+      return write_memory({target_addr::AS_INT_RAM, addr.addr + (offset & 0x18)}, len, buf);
+    }
+
+    default:
+      break;
+    }
+  }
+
+  void target::sync() {
+    if (syncing || (!_cache.dirty(mem_cache::IRAM) && !_cache.dirty(mem_cache::XDATA))) {
+      return;
+    }
+
+    syncing = true;
+    try {
+      _cache.flush(mem_cache::IRAM, [this](uint32_t a, uint32_t n, uint8_t *data) {
+        // write_data takes 8 bit lengths
+        for (uint32_t offset = 0; offset < n; offset += 0x80) {
+          write_data(a + offset, std::min<uint32_t>(n - offset, 0x80), data + offset);
+        }
+      });
+      _cache.flush(mem_cache::XDATA, [this](uint32_t a, uint32_t n, uint8_t *data) {
+        write_xdata(a, n, data);
+      });
+    } catch (...) {
+      syncing = false;
+      throw;
+    }
+    syncing = false;
+  }
+} // namespace debug::core
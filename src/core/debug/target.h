@@ -1,12 +1,38 @@
 #pragma once
 
-#include <list>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
+#include "mem_cache.h"
 #include "mem_remap.h"
 
 namespace debug::core {
+
+  /** one range of a vectored read, a null buf only fills the cache
+  */
+  struct mem_range {
+    target_addr addr;
+    uint32_t len;
+    uint8_t *buf;
+  };
+
+  /** architectural state of the cpu, r holds the registers of the active bank
+  */
+  struct cpu_state {
+    uint16_t pc;
+    uint8_t r[8];
+    uint8_t acc;
+    uint8_t b;
+    uint8_t psw;
+    uint8_t sp;
+    uint8_t dpl0;
+    uint8_t dph0;
+    uint8_t dpl1;
+    uint8_t dph1;
+    uint8_t dps;
+  };
+
   class target {
   public:
     target();
@@ -36,6 +62,11 @@ namespace debug::core {
     /// cause the target to step 1 assembly instruction.
     virtual uint16_t step() = 0;
 
+    /** step count assembly instructions, stops early on a stop request.
+		\returns the pc after the last one
+	*/
+    virtual uint16_t step(uint32_t count);
+
     /** Add a breakpoint.
 		\param addr	address to place the breakpoint at
 		\returns true=success, false=failure
@@ -48,6 +79,19 @@ namespace debug::core {
 	 */
     virtual bool del_breakpoint(uint16_t addr) = 0;
 
+    /** Add a software breakpoint, for targets that can patch a trap into
+		their code once the hardware slots are taken.
+		\param addr	address to place the breakpoint at
+		\returns true=success, false=failure
+	*/
+    virtual bool add_sw_breakpoint(uint16_t) { return false; }
+
+    /** Remove a software breakpoint.
+		\param addr	of breakpoint to remove
+		\returns true=success, false=failure
+	*/
+    virtual bool del_sw_breakpoint(uint16_t) { return false; }
+
     /** Clear all breakpoints currently set in the target
 	*/
     virtual void clear_all_breakpoints() = 0;
@@ -81,8 +125,26 @@ namespace debug::core {
       return true;
     }
 
+    /** read memory through the cache, lines stay valid until the target runs
+	*/
     void read_memory(target_addr addr, int len, uint8_t *buf);
 
+    /** read many ranges at once, overlapping or adjacent ranges of the same
+		space are merged and read in one transfer before the data is scattered
+		back into the buffers
+	*/
+    void read_memory_v(std::vector<mem_range> ranges);
+
+    /** write memory, iram and xdata writes are held back until sync()
+		sfr writes go through immediately after them, they can have side effects
+	*/
+    void write_memory(target_addr addr, int len, uint8_t *buf);
+
+    /** write back everything write_memory held back.
+		Happens on its own before the target steps, runs or resets.
+	*/
+    void sync();
+
     // memory reads
     virtual void read_data(uint8_t addr, uint8_t len, unsigned char *buf) = 0;
     virtual void read_sfr(uint8_t addr, uint8_t len, unsigned char *buf) = 0;
@@ -91,6 +153,10 @@ namespace debug::core {
     virtual void read_code(uint32_t addr, int len, unsigned char *buf) = 0;
     virtual uint16_t read_PC() = 0;
 
+    /** capture all registers at once, the default reads them through the cache
+	*/
+    virtual cpu_state read_cpu_state();
+
     // memory writes
     virtual void write_data(uint8_t addr, uint8_t len, unsigned char *buf) = 0;
     virtual void write_sfr(uint8_t addr, uint8_t len, unsigned char *buf) = 0;
@@ -116,32 +182,35 @@ namespace debug::core {
     // Read Caching functions used for all targets but can be overridden if desired
     ////////////////////////////////////////////////////////////////////////////////
 
+    /** Write back pending writes and drop cached memory that may change
+		while the target runs. Targets call this before they step, run or reset.
+	*/
     virtual void invalidate_cache();
 
-    /** Read an SFR from the cach.  if this register isn't in the cache then
-		read the entire SFR page into the cache.
-	*/
-    virtual void read_sfr_cache(uint8_t addr, uint8_t page, uint8_t len, unsigned char *buf);
+    const mem_cache &cache() const {
+      return _cache;
+    }
 
   protected:
     bool force_stop;
 
-    typedef struct
-    {
-      int page;
-      unsigned char buf[128];
-    } SFR_CACHE_PAGE;
-    typedef std::list<SFR_CACHE_PAGE> SFR_PAGE_LIST;
-    SFR_PAGE_LIST mCacheSfrPages;
-
-    SFR_PAGE_LIST::iterator cache_get_sfr_page(int page) {
-      SFR_PAGE_LIST::iterator it;
-      for (it = mCacheSfrPages.begin(); it != mCacheSfrPages.end(); it++) {
-        if ((*it).page == page)
-          return it;
-      }
-      return mCacheSfrPages.end();
-    }
+    /** Drop cached lines after a write, code lines included.
+	*/
+    void invalidate_cache(mem_cache::space space, uint32_t addr, uint32_t len);
+
+    /** Forget everything cached, pending writes included, e.g. for a new chip.
+	*/
+    void drop_cache();
+
+    /** Registers mapped into a memory space, reads and writes there always
+		go to the target.
+	*/
+    void set_uncached(mem_cache::space space, uint32_t addr, uint32_t len);
+
+  private:
+    mem_cache _cache;
+    // the writes of sync() are already in the cache
+    bool syncing;
   };
 
 } // namespace debug::core
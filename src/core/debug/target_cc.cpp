@@ -1,18 +1,32 @@
 #include "target_cc.h"
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
+#include <vector>
 
+#include "disassembly.h"
+#include "ihex.h"
 #include "log.h"
 
 namespace debug::core {
 
+  // halts the cpu when executed, like a breakpoint
+  static const uint8_t TRAP_OPCODE = 0xA5;
+
   target_cc::target_cc()
       : _port("/dev/ttyACM0")
       , halted_by_breakpoint(false) {
+    // sfrs and radio registers are mapped to xdata 0xdf00-0xdfff,
+    // reading them can pop fifos like RFD or U0DBUF
+    set_uncached(mem_cache::XDATA, 0xdf00, 0x100);
   }
 
   bool target_cc::connect() {
+    // may be a different chip now, code included
+    drop_cache();
+    drop_sw_breakpoints();
+
     dev = std::make_unique<driver::cc_debugger>(port());
     if (!dev->detect()) {
       return false;
@@ -23,26 +37,112 @@ namespace debug::core {
   }
 
   bool target_cc::disconnect() {
-    if (is_connected())
+    if (is_connected()) {
+      sync();
+      // leave the program as it was flashed
+      restore_sw_breakpoints();
       dev->exit();
+    }
 
     dev.release();
     return true;
   }
 
   bool target_cc::load_file(std::string name) {
-    if (!dev->chip_erase()) {
+    if (!is_connected() || is_running()) {
+      log::print("target_cc: tried to load_file on running target\n");
+      return false;
+    }
+
+    // a locked chip reads back garbage, only a full erase unlocks it
+    if (uint16_t(dev->status()) & driver::CC_STATUS_DEBUG_LOCKED) {
+      if (!dev->chip_erase()) {
+        return false;
+      }
+
+      uint16_t status = 0;
+      while ((status & driver::CC_STATUS_CHIP_ERASE_DONE) == 0) {
+        log::print("erasing...\n");
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        status = dev->status();
+      }
+    }
+
+    const auto info = dev->info();
+    const uint32_t page_size = info.page_size;
+    const uint32_t pages = info.flash;
+
+    // set all data to 0xff, since this is the default erased value for flash
+    std::vector<char> image(std::max(pages * page_size, 0x20000u), 0xff);
+
+    log::print("Loading file '{}'\n", name);
+
+    uint32_t start, end;
+    if (!ihex_load_file(name.c_str(), image.data(), &start, &end)) {
+      return false;
+    }
+    if (end >= pages * page_size) {
+      log::print("target_cc: image does not fit into {} bytes of flash\n", pages * page_size);
       return false;
     }
 
-    uint16_t status = 0;
-    while ((status & driver::CC_STATUS_CHIP_ERASE_DONE) == 0) {
-      log::print("erasing...\n");
-      std::this_thread::sleep_for(std::chrono::milliseconds(250));
-      status = dev->status();
+    const auto begin = std::chrono::steady_clock::now();
+
+    // the crc and flash routines stage in sram from 0xf000 behind the
+    // cache, write back what is held first and drop those lines after
+    sync();
+    const uint32_t sram_size = info.sram * 1024;
+
+    // compare every page, so leftovers of a previous image are erased
+    // just like a full chip erase would
+    const auto crcs = dev->page_crc(0, pages);
+    invalidate_cache(mem_cache::XDATA, 0xf000, sram_size);
+
+    std::vector<bool> changed(pages);
+    for (uint32_t i = 0; i < pages; i++) {
+      changed[i] = driver::cc_debugger::crc16((uint8_t *)image.data() + i * page_size, page_size) != crcs[i];
+    }
+
+    uint32_t written = 0;
+    for (uint32_t i = 0; i < pages;) {
+      if (!changed[i]) {
+        i++;
+        continue;
+      }
+
+      // runs of changed pages go out in one pipelined write
+      uint32_t end = i + 1;
+      while (end < pages && changed[end]) {
+        end++;
+      }
+
+      // each page is checked against an on-chip crc right after it was written
+      const auto failed = dev->write_code_raw(i * page_size, (uint8_t *)image.data() + i * page_size, (end - i) * page_size);
+      invalidate_cache(mem_cache::CODE, i * page_size, (end - i) * page_size);
+      invalidate_cache(mem_cache::XDATA, 0xf000, sram_size);
+      for (const auto addr : failed) {
+        log::print("target_cc: verify failed for page at {:#06x}\n", addr);
+      }
+      if (!failed.empty()) {
+        return false;
+      }
+
+      written += end - i;
+      i = end;
+    }
+
+    const auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    log::print("flashed {} of {} pages in {:.1f} ms\n", written, pages, secs * 1000);
+
+    // patched pages differ from the image and were rewritten above,
+    // the traps go back in with the new code before the cpu runs
+    patched_pages.clear();
+    for (const auto addr : sw_breakpoints) {
+      dirty_pages.insert(addr / page_size);
     }
 
-    return target::load_file(name);
+    write_PC(start);
+    return true;
   }
 
   bool target_cc::is_connected() {
@@ -89,29 +189,77 @@ namespace debug::core {
   }
 
   uint16_t target_cc::step() {
-    dev->step();
+    return step(1);
+  }
+
+  uint16_t target_cc::step(uint32_t count) {
+    invalidate_cache();
+    apply_sw_breakpoints();
+
+    if (sw_breakpoints.empty()) {
+      const uint16_t pc = dev->step(count, [this] { return check_stop_forced(); });
+      halted_by_breakpoint = false;
+      return pc;
+    }
+
+    // one at a time, the traps must not be executed
+    uint16_t pc = read_PC();
+    for (uint32_t i = 0; i < count && !check_stop_forced(); i++) {
+      pc = step_instr();
+    }
+    return pc;
+  }
+
+  uint16_t target_cc::step_instr() {
+    const uint16_t pc = read_PC();
     halted_by_breakpoint = false;
-    return read_PC();
+    if (!sw_breakpoints.count(pc)) {
+      return dev->step(1);
+    }
+
+    uint8_t code[3];
+    read_code(pc, sizeof(code), code);
+    return dev->step_replace({decode(code[0]).length, {code[0], code[1], code[2]}});
   }
 
   void target_cc::go() {
     if (is_connected() && !is_running()) {
+      invalidate_cache();
+
+      apply_sw_breakpoints();
+
+      // a trap under the pc would halt right away, get past it first
+      if (sw_breakpoints.count(read_PC())) {
+        step_instr();
+      }
+
       dev->resume();
       halted_by_breakpoint = false;
     }
   }
 
   void target_cc::run_to_bp(int ignore_cnt) {
+    // ignore counts are handled by breakpoint_mgr, which knows the breakpoints
     if (!is_running()) {
       go();
     }
 
-    do {
-      std::this_thread::sleep_for(std::chrono::milliseconds(250));
-      log::print("PC {:#x}\n", dev->pc().response);
-    } while (is_running());
+    // wait in slices, stop() halts the cpu from another thread which ends the wait
+    while (!dev->wait_for_halt(std::chrono::milliseconds(100)))
+      ;
 
+    // reads while running may have cached garbage
+    invalidate_cache();
     halted_by_breakpoint = true;
+
+    // a trap halts after itself, move back onto the patched instruction
+    if (!sw_breakpoints.empty()) {
+      const uint16_t pc = dev->pc();
+      if (sw_breakpoints.count(pc - 1)) {
+        dev->set_pc(pc - 1);
+        halted_by_breakpoint = false;
+      }
+    }
   }
 
   void target_cc::stop() {
@@ -119,6 +267,7 @@ namespace debug::core {
       dev->halt();
       halted_by_breakpoint = false;
     }
+    invalidate_cache();
     target::stop();
   }
 
@@ -136,12 +285,115 @@ namespace debug::core {
     return dev->del_breakpoint(addr);
   }
 
+  bool target_cc::add_sw_breakpoint(uint16_t addr) {
+    if (!is_connected() || is_running()) {
+      return false;
+    }
+    // without step replace the patched instruction can not be executed
+    if ((dev->caps() & driver::CC_CAP_STEP_REPLACE) == 0) {
+      return false;
+    }
+
+    const auto info = dev->info();
+    if (addr >= info.flash * info.page_size) {
+      return false;
+    }
+
+    if (sw_breakpoints.insert(addr).second) {
+      dirty_pages.insert(addr / info.page_size);
+    }
+    return true;
+  }
+
+  bool target_cc::del_sw_breakpoint(uint16_t addr) {
+    if (!is_connected() || is_running() || !sw_breakpoints.erase(addr)) {
+      return false;
+    }
+    dirty_pages.insert(addr / dev->info().page_size);
+    return true;
+  }
+
   void target_cc::clear_all_breakpoints() {
     if (!is_connected() || is_running()) {
       log::print("target_cc: tried to clear_all_breakpoints on running target\n");
       return;
     }
     dev->clear_all_breakpoints();
+
+    for (const auto addr : sw_breakpoints) {
+      dirty_pages.insert(addr / dev->info().page_size);
+    }
+    sw_breakpoints.clear();
+  }
+
+  bool target_cc::apply_sw_breakpoints() {
+    if (dirty_pages.empty()) {
+      return false;
+    }
+
+    const uint32_t page_size = dev->info().page_size;
+    const auto begin = std::chrono::steady_clock::now();
+    const uint16_t pc = read_PC();
+
+    for (auto it = dirty_pages.begin(); it != dirty_pages.end();) {
+      // runs of pages go out with one write
+      const uint32_t first = *it;
+      uint32_t last = first;
+      while (++it != dirty_pages.end() && *it == last + 1) {
+        last = *it;
+      }
+
+      std::vector<uint8_t> data((last - first + 1) * page_size);
+      for (uint32_t page = first; page <= last; page++) {
+        uint8_t *buf = data.data() + (page - first) * page_size;
+
+        auto original = patched_pages.find(page);
+        if (original == patched_pages.end()) {
+          // not patched yet, flash still holds the program
+          std::vector<uint8_t> code(page_size);
+          dev->read_code_raw(page * page_size, code.data(), page_size);
+          original = patched_pages.emplace(page, std::move(code)).first;
+        }
+        std::copy(original->second.begin(), original->second.end(), buf);
+
+        bool patched = false;
+        for (auto bp = sw_breakpoints.lower_bound(page * page_size); bp != sw_breakpoints.end() && *bp < (page + 1) * page_size; ++bp) {
+          buf[*bp - page * page_size] = TRAP_OPCODE;
+          patched = true;
+        }
+        if (!patched) {
+          patched_pages.erase(original);
+        }
+      }
+
+      for (const auto page : dev->patch_code_raw(first * page_size, data.data(), data.size())) {
+        log::print("target_cc: verify failed for page at {:#06x}\n", page);
+      }
+    }
+
+    const auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    log::print("patched {} pages in {:.1f} ms\n", dirty_pages.size(), secs * 1000);
+
+    dirty_pages.clear();
+
+    // the pc was parked behind a hardware breakpoint, resume on it
+    dev->set_pc(pc);
+    halted_by_breakpoint = false;
+    return true;
+  }
+
+  void target_cc::restore_sw_breakpoints() {
+    sw_breakpoints.clear();
+    for (const auto &page : patched_pages) {
+      dirty_pages.insert(page.first);
+    }
+    apply_sw_breakpoints();
+  }
+
+  void target_cc::drop_sw_breakpoints() {
+    sw_breakpoints.clear();
+    patched_pages.clear();
+    dirty_pages.clear();
   }
 
   // memory reads
@@ -184,13 +436,19 @@ namespace debug::core {
       return;
     }
 
-    const auto page_size = dev->info().page_size;
-    const auto pages = len / page_size + (len % page_size ? 1 : 0);
+    dev->read_code_raw(addr, buf, len);
 
-    for (int i = 0; i < pages; i++) {
-      const auto offset = i * page_size;
-      const uint32_t size = std::min(page_size - (addr - offset) % page_size, uint32_t(len - offset));
-      dev->read_code_raw(addr + offset, buf + offset, size);
+    // show the program, not the traps patched into it
+    if (patched_pages.empty()) {
+      return;
+    }
+    const uint32_t page_size = dev->info().page_size;
+    for (const auto &page : patched_pages) {
+      const uint32_t start = std::max(addr, page.first * page_size);
+      const uint32_t end = std::min(addr + len, (page.first + 1) * page_size);
+      for (uint32_t a = start; a < end; a++) {
+        buf[a - addr] = page.second[a - page.first * page_size];
+      }
     }
   }
 
@@ -203,6 +461,32 @@ namespace debug::core {
     return pc;
   }
 
+  cpu_state target_cc::read_cpu_state() {
+    if (!is_connected() || is_running()) {
+      log::print("target_cc: tried to read_cpu_state on running target\n");
+      return {};
+    }
+
+    // registers may have pending writes
+    sync();
+
+    const auto regs = dev->read_regs();
+
+    cpu_state state;
+    state.pc = read_PC();
+    std::copy(regs.r, regs.r + 8, state.r);
+    state.acc = regs.acc;
+    state.b = regs.b;
+    state.psw = regs.psw;
+    state.sp = regs.sp;
+    state.dpl0 = regs.dpl0;
+    state.dph0 = regs.dph0;
+    state.dpl1 = regs.dpl1;
+    state.dph1 = regs.dph1;
+    state.dps = regs.dps;
+    return state;
+  }
+
   // memory writes
   void target_cc::write_data(uint8_t addr, uint8_t len, unsigned char *buf) {
     if (!is_connected() || is_running()) {
@@ -210,6 +494,7 @@ namespace debug::core {
       return;
     }
     dev->write_data_raw(addr, buf, len);
+    invalidate_cache(mem_cache::IRAM, addr, len);
   }
 
   void target_cc::write_sfr(uint8_t addr, uint8_t len, unsigned char *buf) {
@@ -217,6 +502,8 @@ namespace debug::core {
       log::print("target_cc: tried to write_sfr on running target\n");
       return;
     }
+    dev->write_sfr_raw(addr, buf, len);
+    invalidate_cache(mem_cache::SFR, addr, len);
   }
 
   void target_cc::write_sfr(uint8_t addr, uint8_t page, uint8_t len, unsigned char *buf) {
@@ -224,6 +511,8 @@ namespace debug::core {
       log::print("target_cc: tried to write_sfr on running target\n");
       return;
     }
+    dev->write_sfr_raw(addr, buf, len);
+    target::write_sfr(addr, page, len, buf);
   }
 
   void target_cc::write_xdata(uint16_t addr, uint16_t len, unsigned char *buf) {
@@ -232,6 +521,7 @@ namespace debug::core {
       return;
     }
     dev->write_xdata_raw(addr, buf, len);
+    invalidate_cache(mem_cache::XDATA, addr, len);
   }
 
   void target_cc::write_code(uint16_t addr, int len, unsigned char *buf) {
@@ -240,13 +530,18 @@ namespace debug::core {
       return;
     }
 
-    const auto page_size = dev->info().page_size;
-    const auto pages = len / page_size + (len % page_size ? 1 : 0);
-
-    for (int i = 0; i < pages; i++) {
-      const auto offset = i * page_size;
-      const uint32_t size = std::min(page_size - (addr - offset) % page_size, len - offset);
-      dev->write_code_raw(addr + offset, buf + offset, size);
+    // pages are programmed back to back, overlapping transfer and flash writes
+    for (const auto page : dev->write_code_raw(addr, buf, len)) {
+      log::print("target_cc: verify failed for page at {:#06x}\n", page);
+    }
+    invalidate_cache(mem_cache::CODE, addr, len);
+
+    // the new code is the original now, traps go back in before the cpu runs
+    const uint32_t page_size = dev->info().page_size;
+    for (uint32_t page = addr / page_size; page <= (addr + len - 1) / page_size; page++) {
+      if (patched_pages.erase(page)) {
+        dirty_pages.insert(page);
+      }
     }
   }
 
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "cc_debugger.h"
 #include "target.h"
@@ -30,12 +33,15 @@ namespace debug::core {
     bool is_running();
     void reset();
     uint16_t step();
+    uint16_t step(uint32_t count);
     void run_to_bp(int ignore_cnt = 0);
     void go();
     void stop();
 
     bool add_breakpoint(uint16_t addr);
     bool del_breakpoint(uint16_t addr);
+    bool add_sw_breakpoint(uint16_t addr);
+    bool del_sw_breakpoint(uint16_t addr);
     void clear_all_breakpoints();
 
     // memory reads
@@ -45,6 +51,7 @@ namespace debug::core {
     void read_xdata(uint16_t addr, uint16_t len, unsigned char *buf);
     void read_code(uint32_t addr, int len, unsigned char *buf);
     uint16_t read_PC();
+    cpu_state read_cpu_state();
 
     // memory writes
     void write_data(uint8_t addr, uint8_t len, unsigned char *buf);
@@ -59,5 +66,20 @@ namespace debug::core {
     std::unique_ptr<driver::cc_debugger> dev;
 
     bool halted_by_breakpoint;
+
+    // software breakpoints, patched into flash before the cpu runs
+    std::set<uint16_t> sw_breakpoints;
+    // unpatched contents of the flash pages carrying a trap, by page number
+    std::map<uint32_t, std::vector<uint8_t>> patched_pages;
+    // pages whose flash does not match sw_breakpoints yet
+    std::set<uint32_t> dirty_pages;
+
+    // rewrite the dirty pages, each once. true if flash was written
+    bool apply_sw_breakpoints();
+    // put the original code back into flash
+    void restore_sw_breakpoints();
+    void drop_sw_breakpoints();
+    // step one instruction, a patched one is executed from its original bytes
+    uint16_t step_instr();
   };
 } // namespace debug::core
\ No newline at end of file
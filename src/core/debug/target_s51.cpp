@@ -1,6 +1,8 @@
 #include "target_s51.h"
 
 #include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <errno.h> // Error number definitions
 #include <fcntl.h> // File control definitions
@@ -24,7 +26,9 @@ namespace debug::core {
 
   target_s51::target_s51()
       : target()
-      , bConnected(false) {
+      , bConnected(false)
+      , bRunning(false)
+      , in_escape_sequence(false) {
     sock = -1;
     simPid = -1;
   }
@@ -86,9 +90,11 @@ namespace debug::core {
 
     log::print("Simulator started, waiting for prompt\n");
     bConnected = true;
+    rx.clear();
+    in_escape_sequence = false;
 
     log::print("Waiting for sim.\n");
-    recvSim(250);
+    recvSim(2000);
     log::print("Ready.\n");
     return true;
   }
@@ -98,9 +104,11 @@ namespace debug::core {
       return true;
     }
 
+    // no prompt after quit, wait for the simulator to close the socket
+    writeSim("quit\r\n");
+    while (fillSim(2000))
+      ;
     bConnected = false;
-    sendSim("quit");
-    recvSim(2000);
 
     shutdown(sock, 2);
     close(sock);
@@ -142,27 +150,22 @@ namespace debug::core {
     if (!bConnected)
       return "";
 
-    cmd += "\r\n";
-
-    recvSim(timeout_ms / 2);
-
-    size_t written = 0;
-    while (written < cmd.size()) {
-      ssize_t n = write(sock, cmd.c_str() + written, cmd.size() - written);
-      if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-          continue;
-        }
-        throw std::runtime_error("socket write error");
-      }
-      written += n;
+    // anything left over, e.g. a late stop report, would answer this command
+    if (!bRunning) {
+      drainSim();
     }
 
-    std::string line = recvSimLine(timeout_ms);
-    if (line != cmd) {
-      log::print("s51 command verify failed!\n{}", cmd);
+    writeSim(cmd + "\r\n");
+    std::string resp = recvSim(timeout_ms);
+
+    // drop the echo of the command
+    if (resp.compare(0, cmd.size(), cmd) == 0) {
+      const size_t eol = resp.find('\n');
+      resp.erase(0, eol == std::string::npos ? eol : eol + 1);
+    } else {
+      log::print("s51 command verify failed!\n{}\n", cmd);
     }
-    return line;
+    return resp;
   }
 
   std::string target_s51::recvSim(int timeout_ms) {
@@ -171,118 +174,115 @@ namespace debug::core {
       return resp;
     }
 
-    // Initialize the input set
-    fd_set input;
-    FD_ZERO(&input);
-    FD_SET(sock, &input);
-    fcntl(sock, F_SETFL, 0); // block if not enough characters available
-
-    // Initialize the timeout structure
-    struct timeval timeout;
-    timeout.tv_sec = 0; // n seconds timeout
-    timeout.tv_usec = timeout_ms * 1000 / 4;
-
-    bool in_escape_sequence = false;
-
-    while (1) {
-      // Do the select
-      const int n = select(sock + 1, &input, NULL, NULL, &timeout);
-      if (n < 0) {
-        throw std::runtime_error("select failed");
-      }
-      if (n == 0) {
-        // log::print("recvSim timeout\n");
-        break;
-      }
-
-      uint8_t ch = 0;
-
-      const ssize_t r = read(sock, &ch, 1);
-      if (r < 0) {
-        throw std::runtime_error(strerror(errno));
-      }
-      if (r == 0) {
-        // log::print("recvSim timeout\n");
-        break;
-      }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
 
-      if (in_escape_sequence) {
-        if (ch != 0x5B && ch >= 0x40 && ch <= 0x7E)
-          in_escape_sequence = false;
-        continue;
+    size_t end;
+    while ((end = rx.find('\0')) == std::string::npos) {
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0 || !fillSim(left.count())) {
+        // no prompt, hand out what came
+        resp.swap(rx);
+        return resp;
       }
-      if (ch == 0x1B) { // ESC character
-        in_escape_sequence = true;
-        continue;
-      }
-
-      resp += ch;
     }
 
+    resp = rx.substr(0, end);
+    rx.erase(0, end + 1);
     return resp;
   }
 
-  /** Reads from simulator until line end or timeout.
-*/
-  std::string target_s51::recvSimLine(int timeout_ms) {
-    std::string resp;
-    if (!bConnected) {
-      return resp;
+  void target_s51::writeSim(const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+      ssize_t n = write(sock, data.c_str() + written, data.size() - written);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("socket write error");
+      }
+      written += n;
     }
+  }
 
-    // Initialize the input set
+  /** Waits up to timeout_ms for data and appends all of it to rx.
+	false on timeout or when the simulator closed the socket
+*/
+  bool target_s51::fillSim(int timeout_ms) {
     fd_set input;
     FD_ZERO(&input);
     FD_SET(sock, &input);
-    fcntl(sock, F_SETFL, 0); // block if not enough characters available
 
-    // Initialize the timeout structure
     struct timeval timeout;
-    timeout.tv_sec = 0; // n seconds timeout
-    timeout.tv_usec = timeout_ms * 1000;
-
-    bool in_escape_sequence = false;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
 
-    while (1) {
-      // Do the select
-      const int n = select(sock + 1, &input, NULL, NULL, &timeout);
-      if (n < 0) {
-        throw std::runtime_error("select failed");
-      }
-      if (n == 0) {
-        // log::print("recvSimLine timeout\n");
-        break;
+    const int n = select(sock + 1, &input, NULL, NULL, &timeout);
+    if (n < 0) {
+      if (errno == EINTR) {
+        return true;
       }
+      throw std::runtime_error("select failed");
+    }
+    if (n == 0) {
+      return false;
+    }
 
-      char ch = 0;
-
-      const ssize_t r = read(sock, &ch, 1);
-      if (r < 0) {
-        throw std::runtime_error("read failed");
-      }
-      if (r == 0) {
-        // log::print("recvSimLine timeout\n");
-        continue;
-      }
+    char buf[4096];
+    const ssize_t r = read(sock, buf, sizeof(buf));
+    if (r < 0) {
+      throw std::runtime_error(strerror(errno));
+    }
+    if (r == 0) {
+      return false;
+    }
 
+    // strip the escape sequences a run at a time
+    const char *p = buf;
+    const char *const end = buf + r;
+    while (p < end) {
       if (in_escape_sequence) {
-        if (ch != 0x5B && ch >= 0x40 && ch <= 0x7E)
-          in_escape_sequence = false;
-        continue;
-      }
-      if (ch == 0x1B) { // ESC character
-        in_escape_sequence = true;
+        const char *final = std::find_if(p, end, [](char ch) {
+          return ch != 0x5B && ch >= 0x40 && ch <= 0x7E;
+        });
+        if (final == end) {
+          break;
+        }
+        in_escape_sequence = false;
+        p = final + 1;
         continue;
       }
 
-      resp += ch;
-
-      if (ch == '\n') {
+      const char *esc = static_cast<const char *>(memchr(p, 0x1B, end - p));
+      if (esc == nullptr) {
+        rx.append(p, end);
         break;
       }
+      rx.append(p, esc);
+      in_escape_sequence = true;
+      p = esc + 1;
     }
+    return true;
+  }
 
-    return resp;
+  /** Drops whatever already arrived, without waiting
+*/
+  void target_s51::drainSim() {
+    while (fillSim(0))
+      ;
+    rx.clear();
+  }
+
+  /** Consumes the report of a halted simulation once it is complete
+*/
+  bool target_s51::stop_reported() {
+    const size_t pos = rx.find("Stop");
+    if (pos == std::string::npos || rx.find('\0', pos) == std::string::npos) {
+      return false;
+    }
+    rx.erase(0, pos);
+    recvSim(0);
+    return true;
   }
 
   ///////////////////////////////////////////////////////////////////////////////
@@ -290,17 +290,18 @@ namespace debug::core {
   ///////////////////////////////////////////////////////////////////////////////
 
   void target_s51::reset() {
-    sendSim("reset");
-    recvSim(250);
+    invalidate_cache();
     bRunning = false;
+    sendSim("reset");
   }
 
   /** step over one assembly instruction
 	\returns PC
 */
   uint16_t target_s51::step() {
-    sendSim("step", 50);
+    invalidate_cache();
     bRunning = false;
+    sendSim("step");
     return read_PC();
   }
 
@@ -310,8 +311,7 @@ namespace debug::core {
   }
 
   bool target_s51::del_breakpoint(uint16_t addr) {
-    sendSim(fmt::format("clear 0x{:x}", addr));
-    std::string r = recvSim(250);
+    std::string r = sendSim(fmt::format("clear 0x{:x}", addr));
     if (r.find("No breakpoint at") == 0)
       return false;
 
@@ -325,8 +325,7 @@ namespace debug::core {
     // for the simulator we need to clear all at the simulator level
     // in case we have connected to an already sued simulator
     // any other breakpoints will have been cleared by calling the breakpoint_mgr
-    sendSim("info breakpoints");
-    std::string s = recvSim(100);
+    std::string s = sendSim("info breakpoints");
 
     // parse the table deleting as we go
     std::string line;
@@ -344,8 +343,7 @@ namespace debug::core {
       }
 
       auto bpid = std::stoi(line.substr(0, line.find(' ')));
-      sendSim(fmt::format("delete {}", bpid));
-      log::print("{}\n", recvSim(100));
+      log::print("{}\n", sendSim(fmt::format("delete {}", bpid)));
     }
   }
 
@@ -358,19 +356,22 @@ namespace debug::core {
     //					000000 00 .  PSW= 0x01 CY=0 AC=0 OV=0 P=1
     //					F? 0x0078 74 04    MOV   A,#04
     //					F 0x000078
-    // fixme: need to know when sim has actually stopped.
+    invalidate_cache();
     for (int i = 0; i <= ignore_cnt; i++) {
-      sendSim("go");
-      // wait for Stop
-      std::string r;
-      while (1) {
-        r = recvSim(100);
-        if (r.empty())
-          continue;
+      // go() may have started it already
+      if (!bRunning) {
+        go();
+      }
+      // wait for Stop, the report of a stop() from another thread ends it too
+      while (!stop_reported()) {
+        fillSim(100);
+      }
+      bRunning = false;
+      invalidate_cache();
 
-        log::print("r={}\n", r);
-        if (r.find("Stop") != -1)
-          break;
+      if (force_stop) {
+        // halted on request, nothing left to ignore
+        break;
       }
     }
   }
@@ -381,31 +382,42 @@ namespace debug::core {
 
   void target_s51::stop() {
     /// @FIXME problem:S51 aborts when it sees the CTRL-C that newcdb uses to get here.  this is why we see Exit 255 then its all over.
+    // may come from another thread, rx and the cache belong to the one
+    // waiting in run_to_bp or poll_for_halt, it consumes the Stop report
     target::stop();
-    sendSim("stop");
-    recvSim(100);
-    bRunning = false;
+    if (bRunning) {
+      writeSim("stop\r\n");
+    }
   }
 
   /** Start simulator running then return
 */
   void target_s51::go() {
-    sendSim("go");
-    std::string msg = recvSimLine(100);
-    //"Simulation started"
+    invalidate_cache();
+    // "Simulation started", the prompt follows right away
+    const std::string r = sendSim("go");
     bRunning = true;
+
+    // halted before the prompt, leave the report for run_to_bp
+    const size_t pos = r.find("Stop");
+    if (pos != std::string::npos) {
+      rx.insert(0, r.substr(pos) + '\0');
+    }
   }
 
   /** Poll to see if the simulator has stopped
 */
   bool target_s51::poll_for_halt() {
-    // FIXME maybe we should only look for this when we know the simulator is
-    // running
     if (bRunning) {
-      std::string s = recvSim(100);
-      return s.length() > 0;
-    } else
-      return true;
+      while (fillSim(0))
+        ;
+      if (!stop_reported()) {
+        return false;
+      }
+      bRunning = false;
+      invalidate_cache();
+    }
+    return true;
   }
 
   ///////////////////////////////////////////////////////////////////////////////
@@ -413,16 +425,13 @@ namespace debug::core {
   ///////////////////////////////////////////////////////////////////////////////
 
   void target_s51::read_data(uint8_t addr, uint8_t len, unsigned char *buf) {
-    sendSim(fmt::format("di 0x{:02x} 0x{:02x}", addr, (addr + len - 1)));
-    std::string s = recvSim(500);
-    parse_mem_dump(s, buf, len);
+    parse_mem_dump(sendSim(fmt::format("di 0x{:02x} 0x{:02x}", addr, (addr + len - 1))), buf, len);
   }
 
   /** @OBSOLETE
 */
   void target_s51::read_sfr(uint8_t addr, uint8_t len, unsigned char *buf) {
-    sendSim(fmt::format("ds 0x{:02x} 0x{:02x}", addr, (addr + len - 1)));
-    parse_mem_dump(recvSim(250), buf, len);
+    parse_mem_dump(sendSim(fmt::format("ds 0x{:02x} 0x{:02x}", addr, (addr + len - 1))), buf, len);
   }
 
   void target_s51::read_sfr(uint8_t addr, uint8_t page,
@@ -433,21 +442,17 @@ namespace debug::core {
   }
 
   void target_s51::read_xdata(uint16_t addr, uint16_t len, unsigned char *buf) {
-    sendSim(fmt::format("dx 0x{:04x} 0x{:04x}", addr, (addr + len - 1)));
-    parse_mem_dump(recvSim(250), buf, len);
+    parse_mem_dump(sendSim(fmt::format("dx 0x{:04x} 0x{:04x}", addr, (addr + len - 1))), buf, len);
   }
 
   void target_s51::read_code(uint32_t addr, int len, unsigned char *buf) {
-    sendSim(fmt::format("dch 0x{:04x} 0x{:04x}", addr, (addr + len - 1)));
-    parse_mem_dump(recvSim(250), buf, len);
+    parse_mem_dump(sendSim(fmt::format("dch 0x{:04x} 0x{:04x}", addr, (addr + len - 1))), buf, len);
   }
 
   uint16_t target_s51::read_PC() {
     if (!bConnected)
       return 0;
-    std::string r = recvSim(250); // to flush any remaining data
-    sendSim("pc");
-    r = recvSim(250);
+    std::string r = sendSim("pc");
     int pos = r.find("0x", 0);
     int npos = r.find(' ', pos);
     return strtoul(r.substr(pos, npos - pos).c_str(), 0, 16);
@@ -459,12 +464,14 @@ namespace debug::core {
 
   void target_s51::write_data(uint8_t addr, uint8_t len, unsigned char *buf) {
     write_mem("iram", addr, len, buf);
+    invalidate_cache(mem_cache::IRAM, addr, len);
   }
 
   /** @OBSOLETE
 */
   void target_s51::write_sfr(uint8_t addr, uint8_t len, unsigned char *buf) {
     write_mem("sfr", addr, len, buf);
+    invalidate_cache(mem_cache::SFR, addr, len);
   }
 
   void target_s51::write_sfr(uint8_t addr, uint8_t page,
@@ -477,15 +484,16 @@ namespace debug::core {
 
   void target_s51::write_xdata(uint16_t addr, uint16_t len, unsigned char *buf) {
     write_mem("xram", addr, len, buf);
+    invalidate_cache(mem_cache::XDATA, addr, len);
   }
 
   void target_s51::write_code(uint16_t addr, int len, unsigned char *buf) {
     write_mem("rom", addr, len, buf);
+    invalidate_cache(mem_cache::CODE, addr, len);
   }
 
   void target_s51::write_PC(uint16_t addr) {
     sendSim(fmt::format("pc 0x{:04x}", addr));
-    recvSim(250);
   }
 
   void print_buf(unsigned char *buf, int len) {
@@ -510,8 +518,7 @@ namespace debug::core {
       read_data(0, 0x80, buf);
       print_buf(buf, 0x80);
     } else {
-      sendSim(cmd);
-      log::print("{}\n", recvSim(250));
+      log::print("{}\n", sendSim(cmd));
     }
     return true;
   }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 #include <target.h>
 
 namespace debug::core {
@@ -55,14 +57,27 @@ namespace debug::core {
 
     pid_t simPid;
     bool bConnected;
-    bool bRunning;
+    // read by stop() from other threads
+    std::atomic<bool> bRunning;
+
+    // received text with the escape sequences stripped, not consumed yet
+    std::string rx;
+    bool in_escape_sequence;
 
     // Protected functions
     ///////////////////////////////////////////////////////////////////////////
 
+    /** send a command and return its response, timeout_ms only matters
+      when the simulator does not answer
+    */
     std::string sendSim(std::string cmd, uint32_t timeout_ms = 500);
+    /** the text up to the next prompt, a \0 as s51 is started with -P
+    */
     std::string recvSim(int timeout_ms);
-    std::string recvSimLine(int timeout_ms);
+    void writeSim(const std::string &data);
+    bool fillSim(int timeout_ms);
+    void drainSim();
+    bool stop_reported();
     void parse_mem_dump(std::string dump, unsigned char *buf, int len);
     void write_mem(std::string area, uint16_t addr, uint16_t len, unsigned char *buf);
   };
@@ -95,11 +95,13 @@ namespace debug::core {
 
   void target_silabs::reset() {
     log::print("Resetting target.\n");
+    invalidate_cache();
     ec2_target_reset(&obj);
   }
 
   uint16_t target_silabs::step() {
     force_stop = false;
+    invalidate_cache();
     return ec2_step(&obj);
   }
 
@@ -120,14 +122,20 @@ namespace debug::core {
 
   void target_silabs::run_to_bp(int ignore_cnt) {
     log::print("starting a run now...\n");
+    // go() may have started it already
+    bool started = running;
     running = TRUE;
     force_stop = false;
+    invalidate_cache();
     int i = 0;
 
     //obj.debug = true;
     do {
       //ec2_target_run_bp( &obj, &running );
-      ec2_target_go(&obj);
+      if (!started) {
+        ec2_target_go(&obj);
+      }
+      started = false;
       while (!ec2_target_halt_poll(&obj)) {
         usleep(250);
         if (!running) {
@@ -136,6 +144,7 @@ namespace debug::core {
         }
       }
     } while ((i++) != ignore_cnt);
+    running = FALSE;
   }
 
   /** Start the target running.
@@ -143,7 +152,9 @@ namespace debug::core {
 	calling stop will cause the target to be halted.
 */
   void target_silabs::go() {
+    invalidate_cache();
     ec2_target_go(&obj);
+    running = TRUE;
   }
 
   /** Call after starting the target running to determnin if the traget has halted
@@ -215,6 +226,7 @@ namespace debug::core {
   ///////////////////////////////////////////////////////////////////////////////
   void target_silabs::write_data(uint8_t addr, uint8_t len, unsigned char *buf) {
     ec2_write_ram(&obj, (char *)buf, addr, len);
+    invalidate_cache(mem_cache::IRAM, addr, len);
   }
 
   /** @DEPRECIATED
@@ -222,6 +234,7 @@ namespace debug::core {
   void target_silabs::write_sfr(uint8_t addr, uint8_t len, unsigned char *buf) {
     for (uint16_t offset = 0; offset < len; offset++)
       ec2_write_sfr(&obj, buf[offset], addr + offset);
+    invalidate_cache(mem_cache::SFR, addr, len);
   }
 
   void target_silabs::write_sfr(uint8_t addr,
@@ -241,6 +254,7 @@ namespace debug::core {
 
   void target_silabs::write_xdata(uint16_t addr, uint16_t len, unsigned char *buf) {
     ec2_write_xdata(&obj, (char *)buf, addr, len);
+    invalidate_cache(mem_cache::XDATA, addr, len);
   }
 
   void target_silabs::write_code(uint16_t addr, int len, unsigned char *buf) {
@@ -253,6 +267,7 @@ namespace debug::core {
       log::print("Flash write successful.\n");
     else
       log::print("ERROR: Flash write Failed.\n");
+    invalidate_cache(mem_cache::CODE, addr, len);
   }
 
   void target_silabs::write_PC(uint16_t addr) {
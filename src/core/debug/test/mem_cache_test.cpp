@@ -0,0 +1,120 @@
+#include <cstdio>
+#include <vector>
+
+#include "mem_cache.h"
+
+using debug::core::mem_cache;
+
+// xdata 0xdf00-0xdfff holds the cc sfrs and radio registers, reading
+// them pops fifos, so the cache must never fetch them on its own
+
+struct fetch_log {
+  struct fetch {
+    uint32_t addr;
+    uint32_t len;
+  };
+  std::vector<fetch> fetches;
+
+  mem_cache::fetch_func func() {
+    return [this](uint32_t addr, uint32_t len, uint8_t *buf) {
+      fetches.push_back({addr, len});
+      for (uint32_t i = 0; i < len; i++) {
+        buf[i] = uint8_t(addr + i);
+      }
+    };
+  }
+
+  // bytes of the window fetched
+  uint32_t window_bytes() const {
+    uint32_t n = 0;
+    for (const auto &f : fetches) {
+      for (uint32_t a = f.addr; a < f.addr + f.len; a++) {
+        n += a >= 0xdf00 && a < 0xe000;
+      }
+    }
+    return n;
+  }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+// reads next to the xdata register window
+static void test_uncached_window() {
+  mem_cache cache;
+  cache.set_uncached(mem_cache::XDATA, 0xdf00, 0x100);
+  uint8_t buf[8];
+
+  {
+    // right below the window, read ahead would cover 0xdf00-0xdf3f
+    fetch_log log;
+    cache.read(mem_cache::XDATA, 0xdefe, 2, buf, log.func());
+    check(log.window_bytes() == 0, "read below the window fetched it");
+    check(buf[0] == 0xfe && buf[1] == 0xff, "read below the window");
+  }
+
+  {
+    // across the start, only the requested window bytes
+    fetch_log log;
+    cache.read(mem_cache::XDATA, 0xdefe, 4, buf, log.func());
+    check(log.window_bytes() == 2, "read across the window fetched more than asked");
+    check(buf[2] == 0x00 && buf[3] == 0x01, "read across the window");
+
+    // and again, nothing of the window is cached
+    log.fetches.clear();
+    cache.read(mem_cache::XDATA, 0xdefe, 4, buf, log.func());
+    check(log.window_bytes() == 2, "window bytes were cached");
+  }
+
+  {
+    // right above the window
+    fetch_log log;
+    cache.read(mem_cache::XDATA, 0xe000, 1, buf, log.func());
+    check(log.window_bytes() == 0, "read above the window fetched it");
+  }
+
+  check(cache.uncached(mem_cache::XDATA, 0xdfd9, 1), "RFD not uncached");
+  check(!cache.uncached(mem_cache::XDATA, 0xdec0, 0x40), "line below the window uncached");
+}
+
+// iram lines with read ahead add up to a 256 byte fetch, the target
+// reads take an 8 bit length and would see 0
+static void test_chunked_fetch() {
+  mem_cache cache;
+  uint8_t buf[0x100];
+
+  fetch_log log;
+  const auto read_data = [&log](uint32_t addr, uint32_t len, uint8_t *data) {
+    check(len > 0 && len <= 0xff, "fetch length does not fit 8 bits");
+    log.func()(addr, uint8_t(len), data);
+  };
+
+  cache.read(mem_cache::IRAM, 0x00, 0xf0, buf, mem_cache::chunked(0x80, read_data));
+  bool same = true;
+  for (uint32_t i = 0; i < 0xf0; i++) {
+    same &= buf[i] == i;
+  }
+  check(same, "chunked iram read returned wrong data");
+
+  // the lines are valid now, nothing is fetched again
+  log.fetches.clear();
+  cache.read(mem_cache::IRAM, 0x00, 0x100, buf, mem_cache::chunked(0x80, read_data));
+  check(log.fetches.empty(), "full iram read fetched again");
+  check(buf[0xff] == 0xff, "full iram read");
+}
+
+int main() {
+  test_uncached_window();
+  test_chunked_fetch();
+
+  if (failures == 0) {
+    printf("mem_cache: ok\n");
+  }
+  return failures == 0 ? 0 : 1;
+}
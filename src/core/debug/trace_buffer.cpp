@@ -0,0 +1,95 @@
+#include "trace_buffer.h"
+
+#include <algorithm>
+
+#include "log.h"
+
+namespace debug::core {
+
+  trace_buffer::trace_buffer(size_t capacity)
+      : ring(std::max<size_t>(capacity, 1))
+      , head(0)
+      , count(0)
+      , next_seq(0)
+      , stream(false)
+      , start(std::chrono::steady_clock::now()) {
+  }
+
+  void trace_buffer::push(std::chrono::steady_clock::time_point when, std::chrono::microseconds halt, int32_t bp_id, ADDR addr, std::string text) {
+    trace_record &rec = ring[(head + count) % ring.size()];
+    rec = {
+        next_seq++,
+        std::chrono::duration_cast<std::chrono::microseconds>(when - start),
+        halt,
+        bp_id,
+        addr,
+        std::move(text),
+    };
+
+    if (count < ring.size()) {
+      count++;
+    } else {
+      head = (head + 1) % ring.size();
+    }
+
+    if (stream) {
+      log::print("{}\n", format(rec));
+    }
+  }
+
+  void trace_buffer::clear() {
+    head = 0;
+    count = 0;
+    next_seq = 0;
+    start = std::chrono::steady_clock::now();
+  }
+
+  void trace_buffer::set_capacity(size_t capacity) {
+    auto kept = records();
+    const size_t size = std::max<size_t>(capacity, 1);
+    if (kept.size() > size) {
+      kept.erase(kept.begin(), kept.end() - size);
+    }
+
+    const uint64_t seq = next_seq;
+    ring = std::move(kept);
+    count = ring.size();
+    ring.resize(size);
+    head = 0;
+    next_seq = seq;
+  }
+
+  std::vector<trace_record> trace_buffer::records() const {
+    std::vector<trace_record> res;
+    res.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      res.push_back(ring[(head + i) % ring.size()]);
+    }
+    return res;
+  }
+
+  std::string trace_buffer::format(const trace_record &rec) {
+    return fmt::format("#{} {}.{:06}s bp {} at 0x{:04x} (halted {}us): {}",
+                       rec.seq,
+                       rec.time.count() / 1000000,
+                       rec.time.count() % 1000000,
+                       rec.bp_id,
+                       rec.addr,
+                       rec.halt.count(),
+                       rec.text);
+  }
+
+  void trace_buffer::dump() const {
+    if (count == 0) {
+      log::print("Trace buffer is empty.\n");
+      return;
+    }
+    for (const auto &rec : records()) {
+      log::print("{}\n", format(rec));
+    }
+    if (dropped()) {
+      log::print("{} older records were overwritten.\n", dropped());
+    }
+  }
+
+} // namespace debug::core
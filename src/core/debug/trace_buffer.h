@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace debug::core {
+
+  /** one tracepoint hit
+  */
+  struct trace_record {
+    uint64_t seq;
+    // since the buffer was cleared
+    std::chrono::microseconds time;
+    // from seeing the halt to resuming the target
+    std::chrono::microseconds halt;
+
+    int32_t bp_id;
+    ADDR addr;
+    std::string text;
+  };
+
+  /** ring buffer of tracepoint hits, the oldest records are overwritten
+  */
+  class trace_buffer {
+  public:
+    static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+    trace_buffer(size_t capacity = DEFAULT_CAPACITY);
+
+    void push(std::chrono::steady_clock::time_point when, std::chrono::microseconds halt, int32_t bp_id, ADDR addr, std::string text);
+    void clear();
+
+    void set_capacity(size_t capacity);
+    size_t capacity() const { return ring.size(); }
+    size_t size() const { return count; }
+    // records lost to overwriting since the last clear
+    uint64_t dropped() const { return next_seq - count; }
+
+    /** print every record as it is pushed, e.g. as dap output events
+    */
+    void set_stream(bool enabled) { stream = enabled; }
+    bool streaming() const { return stream; }
+
+    // oldest first
+    std::vector<trace_record> records() const;
+
+    static std::string format(const trace_record &rec);
+    void dump() const;
+
+  protected:
+    std::vector<trace_record> ring;
+    size_t head;
+    size_t count;
+    uint64_t next_seq;
+    bool stream;
+    std::chrono::steady_clock::time_point start;
+  };
+
+} // namespace debug::core
@@ -14,10 +14,41 @@
 
 namespace driver::core {
 
-  serial::serial(std::string port)
-      : _port(port)
-      , fd(0) {
-    fd = open(port.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
+  static speed_t baud_to_speed(uint32_t baud) {
+    switch (baud) {
+    case 9600:
+      return B9600;
+    case 19200:
+      return B19200;
+    case 38400:
+      return B38400;
+    case 57600:
+      return B57600;
+    case 115200:
+      return B115200;
+    case 230400:
+      return B230400;
+    case 460800:
+      return B460800;
+    case 921600:
+      return B921600;
+    case 1000000:
+      return B1000000;
+    case 2000000:
+      return B2000000;
+    case 3000000:
+      return B3000000;
+    case 4000000:
+      return B4000000;
+    default:
+      throw std::runtime_error("unsupported baud rate " + std::to_string(baud));
+    }
+  }
+
+  serial::serial(std::string port, serial_config cfg)
+      : fd_transport(cfg.timeout)
+      , _port(port) {
+    fd = open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (fd < 0) {
       throw std::runtime_error(strerror(errno));
     }
@@ -27,11 +58,11 @@ namespace driver::core {
       throw std::runtime_error(strerror(errno));
     }
 
-    // Set the baud rates to 115200
-    if (cfsetispeed(&tty, B115200) != 0) {
+    const speed_t speed = baud_to_speed(cfg.baud);
+    if (cfsetispeed(&tty, speed) != 0) {
       throw std::runtime_error(strerror(errno));
     }
-    if (cfsetospeed(&tty, B115200) != 0) {
+    if (cfsetospeed(&tty, speed) != 0) {
       throw std::runtime_error(strerror(errno));
     }
 
@@ -56,7 +87,8 @@ namespace driver::core {
     // select raw output
     tty.c_oflag &= ~OPOST;
 
-    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VMIN] = cfg.vmin;
+    tty.c_cc[VTIME] = cfg.vtime;
 
     // Set the new options for the port...
     if (tcsetattr(fd, TCSANOW, &tty) != 0) {
@@ -64,36 +96,4 @@ namespace driver::core {
     }
   }
 
-  serial::~serial() {
-    close(fd);
-  }
-
-  void serial::read(uint8_t *data, size_t size) {
-    size_t read = 0;
-    while (read < size) {
-      ssize_t n = ::read(fd, data + read, size - read);
-      if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-          continue;
-        }
-        throw std::runtime_error("socket write error");
-      }
-      read += n;
-    }
-  }
-
-  void serial::write(uint8_t *data, size_t size) {
-    size_t written = 0;
-    while (written < size) {
-      ssize_t n = ::write(fd, data + written, size - written);
-      if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-          continue;
-        }
-        throw std::runtime_error("socket write error");
-      }
-      written += n;
-    }
-  }
-
-} // namespace driver::core
\ No newline at end of file
+} // namespace driver::core
@@ -1,20 +1,26 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <string>
-#include <vector>
+
+#include "transport.h"
 
 namespace driver::core {
-  class serial {
-  public:
-    serial(std::string port);
-    ~serial();
+  struct serial_config {
+    uint32_t baud = 115200;
+    // termios VMIN/VTIME, only relevant for blocking readers of the same tty
+    uint8_t vmin = 1;
+    uint8_t vtime = 0;
+    // deadline for a single read or write call
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(2000);
+  };
 
-    void read(uint8_t *data, size_t size);
-    void write(uint8_t *data, size_t size);
+  class serial : public fd_transport {
+  public:
+    serial(std::string port, serial_config cfg = serial_config());
 
   private:
     std::string _port;
-
-    int fd;
   };
-} // namespace driver::core
\ No newline at end of file
+} // namespace driver::core
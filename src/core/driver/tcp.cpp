@@ -0,0 +1,56 @@
+#include "tcp.h"
+
+#include <stdexcept>
+
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace driver::core {
+
+  tcp::tcp(std::string host, uint16_t port, std::chrono::milliseconds timeout)
+      : fd_transport(timeout)
+      , _host(host)
+      , _port(port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *res = nullptr;
+    const int err = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res);
+    if (err != 0) {
+      throw std::runtime_error(gai_strerror(err));
+    }
+
+    for (auto *ai = res; ai != nullptr; ai = ai->ai_next) {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0) {
+        continue;
+      }
+      if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        break;
+      }
+      close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+      throw std::runtime_error("failed to connect to " + host + ":" + std::to_string(port));
+    }
+
+    // frames are small, do not let nagle hold them back
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+} // namespace driver::core
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "transport.h"
+
+namespace driver::core {
+  /** transport to a probe shared over the network, eg. by ser2net
+  */
+  class tcp : public fd_transport {
+  public:
+    tcp(std::string host, uint16_t port, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000));
+
+  private:
+    std::string _host;
+    uint16_t _port;
+  };
+} // namespace driver::core
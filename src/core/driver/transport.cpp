@@ -0,0 +1,158 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <string.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace driver::core {
+
+  transport::transport(std::chrono::milliseconds timeout)
+      : timeout(timeout) {
+  }
+
+  transport::~transport() {
+  }
+
+  void transport::read(uint8_t *data, size_t size) {
+    read(data, size, timeout);
+  }
+
+  void transport::write(const uint8_t *data, size_t size) {
+    struct iovec iov = {const_cast<uint8_t *>(data), size};
+    write(&iov, 1);
+  }
+
+  const transport_stats &transport::stats() const {
+    return _stats;
+  }
+
+  void transport::reset_stats() {
+    _stats = transport_stats();
+  }
+
+  fd_transport::fd_transport(std::chrono::milliseconds timeout)
+      : transport(timeout)
+      , fd(-1)
+      , rx_buf(4096)
+      , rx_pos(0)
+      , rx_len(0) {
+  }
+
+  fd_transport::~fd_transport() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  bool fd_transport::poll_fd(short events, std::chrono::steady_clock::time_point deadline) {
+    struct pollfd pfd = {fd, events, 0};
+    while (true) {
+      const auto start = std::chrono::steady_clock::now();
+      // round up, truncating would turn the last millisecond into a spin
+      const auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - start).count();
+      const int timeout_ms = remaining <= 0 ? 0 : (remaining + 999) / 1000;
+
+      const int res = poll(&pfd, 1, timeout_ms);
+      _stats.wait_time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("socket poll error");
+      }
+      if (res > 0 && (pfd.revents & (POLLERR | POLLNVAL))) {
+        throw std::runtime_error("socket poll error");
+      }
+      return res > 0;
+    }
+  }
+
+  void fd_transport::read(uint8_t *data, size_t size, std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    size_t read = 0;
+    while (read < size) {
+      if (rx_pos < rx_len) {
+        const size_t n = std::min(size - read, rx_len - rx_pos);
+        memcpy(data + read, rx_buf.data() + rx_pos, n);
+        rx_pos += n;
+        read += n;
+        continue;
+      }
+
+      // refill with whatever the line has ready, not just the requested bytes
+      const ssize_t n = ::read(fd, rx_buf.data(), rx_buf.size());
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          throw std::runtime_error("socket read error");
+        }
+        if (!poll_fd(POLLIN, deadline)) {
+          throw std::runtime_error("socket read timeout");
+        }
+        continue;
+      }
+      if (n == 0) {
+        throw std::runtime_error("socket closed");
+      }
+
+      rx_pos = 0;
+      rx_len = n;
+      _stats.reads++;
+      _stats.bytes_read += n;
+    }
+  }
+
+  void fd_transport::write(const struct iovec *iov, size_t count) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    std::vector<struct iovec> pending(iov, iov + count);
+    size_t first = 0;
+    while (first < pending.size()) {
+      const int cnt = std::min<size_t>(pending.size() - first, IOV_MAX);
+      ssize_t n = ::writev(fd, pending.data() + first, cnt);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          throw std::runtime_error("socket write error");
+        }
+        if (!poll_fd(POLLOUT, deadline)) {
+          throw std::runtime_error("socket write timeout");
+        }
+        continue;
+      }
+
+      _stats.writes++;
+      _stats.bytes_written += n;
+
+      // skip over the buffers written completely, trim a partial one
+      while (first < pending.size() && size_t(n) >= pending[first].iov_len) {
+        n -= pending[first].iov_len;
+        first++;
+      }
+      if (first < pending.size()) {
+        pending[first].iov_base = static_cast<uint8_t *>(pending[first].iov_base) + n;
+        pending[first].iov_len -= n;
+      }
+    }
+  }
+
+  bool fd_transport::wait(int timeout_ms) {
+    if (rx_pos < rx_len) {
+      return true;
+    }
+    return poll_fd(POLLIN, std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms));
+  }
+
+} // namespace driver::core
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace driver::core {
+  struct transport_stats {
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    // time spent blocked waiting for the link
+    std::chrono::microseconds wait_time = std::chrono::microseconds(0);
+  };
+
+  /** Byte stream to a probe. Reads and writes block until done and throw
+    once the deadline expires.
+  */
+  class transport {
+  public:
+    transport(std::chrono::milliseconds timeout);
+    virtual ~transport();
+
+    void read(uint8_t *data, size_t size);
+    virtual void read(uint8_t *data, size_t size, std::chrono::milliseconds timeout) = 0;
+
+    void write(const uint8_t *data, size_t size);
+    // writes all buffers with as few syscalls as possible
+    virtual void write(const struct iovec *iov, size_t count) = 0;
+
+    // wait up to timeout_ms for incoming data, returns false on timeout
+    virtual bool wait(int timeout_ms) = 0;
+
+    const transport_stats &stats() const;
+    void reset_stats();
+
+  protected:
+    // deadline for a single read or write call
+    std::chrono::milliseconds timeout;
+    transport_stats _stats;
+  };
+
+  /** transport over a non-blocking file descriptor, shared by tty and socket backends
+  */
+  class fd_transport : public transport {
+  public:
+    fd_transport(std::chrono::milliseconds timeout);
+    ~fd_transport();
+
+    using transport::read;
+    void read(uint8_t *data, size_t size, std::chrono::milliseconds timeout) override;
+
+    using transport::write;
+    void write(const struct iovec *iov, size_t count) override;
+
+    bool wait(int timeout_ms) override;
+
+  protected:
+    int fd;
+
+  private:
+    // bytes already read from the fd but not handed out yet
+    std::vector<uint8_t> rx_buf;
+    size_t rx_pos;
+    size_t rx_len;
+
+    bool poll_fd(short events, std::chrono::steady_clock::time_point deadline);
+  };
+} // namespace driver::core
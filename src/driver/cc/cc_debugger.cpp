@@ -1,9 +1,15 @@
 #include "cc_debugger.h"
 
+#include <algorithm>
+#include <cstring>
+#include <thread>
 #include <vector>
 
 #include <fmt/format.h>
 
+#include "cc_loopback.h"
+#include "tcp.h"
+
 #define LOBYTE(w) ((uint8_t)(w))
 #define HIBYTE(w) ((uint8_t)(((uint16_t)(w) >> 8) & 0xFF))
 
@@ -15,28 +21,19 @@ namespace driver {
     uint8_t _unused : 3;
   };
 
-  struct stack_guard {
-    stack_guard(cc_debugger &dev, std::vector<uint8_t> _regs)
-        : dev(dev)
-        , regs(_regs) {
-      acc = dev.instr(0xE5, 0xE0);
-      values.resize(regs.size());
-      for (size_t i = 0; i < regs.size(); i++) {
-        values[i] = uint16_t(dev.instr(0xE5, regs[i])); // PUSH
-      }
-    }
-
-    ~stack_guard() {
-      for (int i = regs.size() - 1; i >= 0; i--) {
-        dev.instr(0x75, regs[i], values[i]); // POP
-      }
-      dev.instr(0x74, acc);
-    }
-
-    uint16_t acc;
-    cc_debugger &dev;
-    std::vector<uint8_t> regs;
-    std::vector<uint8_t> values;
+  // registers clobbered by the debug access routines, ACC has to come first
+  static const std::array<uint8_t, 11> access_regs = {
+      0xE0, // ACC
+      0xF0, // B
+      0xD0, // PSW
+      0x82, // DPL0
+      0x83, // DPH0
+      0x84, // DPL1
+      0x85, // DPH1
+      0x92, // DPS
+      0xC7, // MEMCTR
+      0xD2, // DMA1CFGL
+      0xD3, // DMA1CFGH
   };
 
   std::map<uint32_t, cc_chip_info>
@@ -44,8 +41,33 @@ namespace driver {
           {0x8100, {16, 0x400, 0x800, false, 2, 2}},
   };
 
-  cc_debugger::cc_debugger(std::string port)
-      : serial(port) {
+  static std::unique_ptr<core::transport> open_transport(const std::string &port, core::serial_config cfg) {
+    if (port.rfind("tcp://", 0) == 0) {
+      const auto addr = port.substr(6);
+      const auto sep = addr.rfind(':');
+      if (sep == std::string::npos) {
+        throw std::runtime_error("missing tcp port in " + port);
+      }
+      return std::make_unique<core::tcp>(addr.substr(0, sep), std::stoi(addr.substr(sep + 1)), cfg.timeout);
+    }
+    if (port.rfind("loop://", 0) == 0) {
+      return std::make_unique<cc_loopback>();
+    }
+    return std::make_unique<core::serial>(port, cfg);
+  }
+
+  cc_debugger::cc_debugger(std::string port, core::serial_config cfg)
+      : cc_debugger(open_transport(port, cfg)) {
+  }
+
+  cc_debugger::cc_debugger(std::unique_ptr<core::transport> link)
+      : link(std::move(link))
+      , probe_caps(0)
+      , halt_pending(false)
+      , frame_count(0)
+      , pipeline_count(0)
+      , access_active(false)
+      , breakpoints_known(false) {
     for (size_t i = 0; i < breakpoints.size(); i++) {
       breakpoints[i] = {
           false,
@@ -54,13 +76,70 @@ namespace driver {
     }
   }
 
-  cc_debugger_response cc_debugger::send(cc_debugger_request req) {
-    cc_debugger_response res;
-    mu.lock();
-    serial.write(reinterpret_cast<uint8_t *>(&req), sizeof(cc_debugger_request));
-    serial.read(reinterpret_cast<uint8_t *>(&res), sizeof(cc_debugger_response));
-    mu.unlock();
-    return res;
+  cc_pipeline::cc_pipeline(cc_debugger &dev, size_t depth)
+      : dev(dev)
+      , depth(std::max<size_t>(depth, 1))
+      , lock(dev.mu) {}
+
+  size_t cc_pipeline::push(cc_debugger_request req, const uint8_t *data, size_t data_size, uint8_t *out, size_t out_size) {
+    frame f;
+    f.data.resize(sizeof(cc_debugger_request) + data_size);
+    memcpy(f.data.data(), &req, sizeof(cc_debugger_request));
+    if (data_size) {
+      memcpy(f.data.data() + sizeof(cc_debugger_request), data, data_size);
+    }
+    f.out = out;
+    f.out_size = out_size;
+
+    frames.push_back(std::move(f));
+    return frames.size() - 1;
+  }
+
+  std::vector<cc_debugger_response> cc_pipeline::collect() {
+    std::vector<cc_debugger_response> responses(frames.size());
+    std::vector<struct iovec> iov;
+
+    size_t sent = 0;
+    for (size_t i = 0; i < frames.size(); i++) {
+      // top up the window with a single vectored write
+      iov.clear();
+      for (; sent < frames.size() && sent < i + depth; sent++) {
+        iov.push_back({frames[sent].data.data(), frames[sent].data.size()});
+      }
+      if (iov.size()) {
+        dev.link->write(iov.data(), iov.size());
+      }
+
+      auto &res = responses[i];
+      dev.read_response(res);
+      if (frames[i].out_size && res.ans != ANS_ERROR) {
+        // variable length responses carry their data after the header
+        dev.link->read(frames[i].out, frames[i].out_size);
+      }
+    }
+
+    dev.frame_count += frames.size();
+    dev.pipeline_count++;
+
+    frames.clear();
+    return responses;
+  }
+
+  void cc_debugger::read_response(cc_debugger_response &res) {
+    while (true) {
+      link->read(reinterpret_cast<uint8_t *>(&res), sizeof(cc_debugger_response));
+      if (res.ans != ANS_HALTED) {
+        break;
+      }
+      // halt notification overtook the response, remember it for wait_for_halt
+      halt_pending = true;
+    }
+  }
+
+  cc_debugger_response cc_debugger::send(cc_debugger_request req, const uint8_t *data, size_t data_size, uint8_t *out, size_t out_size) {
+    cc_pipeline pipeline(*this, 1);
+    pipeline.push(req, data, data_size, out, out_size);
+    return pipeline.collect()[0];
   }
 
   cc_debugger::response_or_error cc_debugger::send_frame(cc_debugger_request req) {
@@ -104,13 +183,46 @@ namespace driver {
   }
 
   bool cc_debugger::ping() {
-    return send_frame({
+    const auto res = send({
         driver::CC_CMD_PING,
         {0, 0, 0},
     });
+    if (res.ans == ANS_ERROR) {
+      return false;
+    }
+
+    // only trust the payload when the firmware marks it as capabilities
+    probe_caps = res.ans == ANS_CAPS ? (res.payload[0] << 8) | res.payload[1] : 0;
+    return true;
+  }
+
+  uint16_t cc_debugger::caps() {
+    return probe_caps;
+  }
+
+  cc_debugger_stats cc_debugger::stats() {
+    std::lock_guard<std::mutex> lock(mu);
+    return {
+        frame_count,
+        pipeline_count,
+        link->stats(),
+    };
+  }
+
+  void cc_debugger::reset_stats() {
+    std::lock_guard<std::mutex> lock(mu);
+    frame_count = 0;
+    pipeline_count = 0;
+    link->reset_stats();
   }
 
   bool cc_debugger::enter() {
+    // entering debug mode resets the chip, nothing left to restore
+    access_active = false;
+    breakpoints_known = false;
+    for (auto &bp : breakpoints) {
+      bp = {false, 0x0};
+    }
     return send_frame({
         driver::CC_CMD_ENTER,
         {0, 0, 0},
@@ -118,6 +230,7 @@ namespace driver {
   }
 
   bool cc_debugger::exit() {
+    end_access();
     return send_frame({
         driver::CC_CMD_EXIT,
         {0, 0, 0},
@@ -125,12 +238,78 @@ namespace driver {
   }
 
   bool cc_debugger::step() {
+    end_access();
     return send_frame({
         driver::CC_CMD_STEP,
         {0, 0, 0},
     });
   }
 
+  cc_debugger::response_or_error cc_debugger::step(uint32_t count, const std::function<bool()> &stopped) {
+    end_access();
+
+    if (probe_caps & CC_CAP_STEP_N) {
+      // STEP_N answers with the pc after the last step, only read it
+      // separately when there is nothing to step
+      if (count == 0) {
+        return pc();
+      }
+
+      // the count is 16 bit wide
+      response_or_error res;
+      while (count > 0) {
+        const uint16_t n = std::min<uint32_t>(count, 0xFFFF);
+        res = send_frame({
+            driver::CC_CMD_STEP_N,
+            {HIBYTE(n), LOBYTE(n), 0},
+        });
+        if (!res) {
+          return res;
+        }
+        count -= n;
+        if (count > 0 && stopped && stopped()) {
+          break;
+        }
+      }
+      return res;
+    }
+
+    // queue the single steps and the pc read back to back, one pipeline
+    // window at a time so a stop request gets through in between
+    response_or_error res;
+    do {
+      const uint32_t n = std::min<uint32_t>(count, cc_pipeline::default_depth);
+
+      cc_pipeline pipeline(*this);
+      for (uint32_t i = 0; i < n; i++) {
+        pipeline.push({driver::CC_CMD_STEP, {0, 0, 0}});
+      }
+      pipeline.push({driver::CC_CMD_PC, {0, 0, 0}});
+
+      const auto responses = pipeline.collect();
+      for (const auto &r : responses) {
+        if (r.ans == ANS_ERROR) {
+          return fmt::format("cc debugger step error {:#x}", r.payload[1]);
+        }
+      }
+      res = (responses.back().payload[0] << 8) | responses.back().payload[1];
+      count -= n;
+    } while (count > 0 && !(stopped && stopped()));
+    return res;
+  }
+
+  cc_debugger::response_or_error cc_debugger::step_replace(cc_instr instr) {
+    if ((probe_caps & CC_CAP_STEP_REPLACE) == 0) {
+      return std::string("probe does not support step replace");
+    }
+
+    end_access();
+    return send_frame({
+        driver::CC_CMD_STEP_REPLACE,
+        {instr.code[0], instr.code[1], instr.code[2]},
+    });
+  }
+
   cc_debugger::response_or_error cc_debugger::instr(uint8_t c1) {
     return send_frame({
         CC_CMD_EXEC_1,
@@ -152,6 +331,86 @@ namespace driver {
     });
   }
 
+  std::vector<uint8_t> cc_debugger::exec(const cc_instr_batch &batch) {
+    const auto &instrs = batch.get_instrs();
+    std::vector<uint8_t> results(instrs.size());
+
+    cc_pipeline pipeline(*this);
+
+    if ((probe_caps & CC_CAP_EXEC_BATCH) == 0) {
+      // probe firmware does not support batches, queue them one by one
+      for (const auto &i : instrs) {
+        const auto cmd = cc_debugger_cmd(CC_CMD_EXEC_1 + i.length - 1);
+        pipeline.push({cmd, {i.code[0], i.code[1], i.code[2]}});
+      }
+
+      const auto res = pipeline.collect();
+      for (size_t n = 0; n < res.size(); n++) {
+        if (res[n].ans == ANS_ERROR) {
+          throw std::runtime_error(fmt::format("cc debugger instr error {:#x}", res[n].payload[1]));
+        }
+        results[n] = res[n].payload[1];
+      }
+      return results;
+    }
+
+    std::vector<uint8_t> stream;
+    for (size_t offset = 0; offset < instrs.size(); offset += cc_instr_batch::max_size) {
+      const size_t count = std::min(cc_instr_batch::max_size, instrs.size() - offset);
+
+      stream.clear();
+      for (size_t n = offset; n < offset + count; n++) {
+        stream.push_back(instrs[n].length);
+        stream.insert(stream.end(), instrs[n].code, instrs[n].code + instrs[n].length);
+      }
+
+      pipeline.push(
+          {
+              CC_CMD_EXEC_BATCH,
+              {uint8_t(count), HIBYTE(stream.size()), LOBYTE(stream.size())},
+          },
+          stream.data(), stream.size(),
+          results.data() + offset, count);
+    }
+
+    for (const auto &res : pipeline.collect()) {
+      if (res.ans == ANS_ERROR) {
+        throw std::runtime_error(fmt::format("cc debugger batch error {:#x}", res.payload[1]));
+      }
+    }
+    return results;
+  }
+
+  void cc_debugger::read_block(cc_debugger_cmd cmd, uint16_t addr, uint8_t *buf, uint32_t size) {
+    cc_pipeline pipeline(*this);
+    for (uint32_t offset = 0; offset < size; offset += max_block_size) {
+      const uint32_t len = std::min(max_block_size, size - offset);
+      const uint16_t a = addr + offset;
+      pipeline.push({cmd, {HIBYTE(a), LOBYTE(a), uint8_t(len)}}, nullptr, 0, buf + offset, len);
+    }
+
+    for (const auto &res : pipeline.collect()) {
+      if (res.ans == ANS_ERROR) {
+        throw std::runtime_error(fmt::format("cc debugger block read error {:#x}", res.payload[1]));
+      }
+    }
+  }
+
+  void cc_debugger::write_block(cc_debugger_cmd cmd, uint16_t addr, const uint8_t *buf, uint32_t size) {
+    cc_pipeline pipeline(*this);
+    for (uint32_t offset = 0; offset < size; offset += max_block_size) {
+      const uint32_t len = std::min(max_block_size, size - offset);
+      const uint16_t a = addr + offset;
+      pipeline.push({cmd, {HIBYTE(a), LOBYTE(a), uint8_t(len)}}, buf + offset, len);
+    }
+
+    for (const auto &res : pipeline.collect()) {
+      if (res.ans == ANS_ERROR) {
+        throw std::runtime_error(fmt::format("cc debugger block write error {:#x}", res.payload[1]));
+      }
+    }
+  }
+
   cc_debugger::response_or_error cc_debugger::chip_id() {
     return send_frame({
         driver::CC_CMD_CHIP_ID,
@@ -196,9 +455,16 @@ namespace driver {
   }
 
   bool cc_debugger::resume() {
+    end_access();
+
+    const uint8_t notify = (probe_caps & CC_CAP_HALT_NOTIFY) ? 1 : 0;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      halt_pending = false;
+    }
     return send_frame({
         driver::CC_CMD_RESUME,
-        {0, 0, 0},
+        {notify, 0, 0},
     });
   }
 
@@ -209,7 +475,67 @@ namespace driver {
     });
   }
 
+  bool cc_debugger::wait_for_halt(std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    if ((probe_caps & CC_CAP_HALT_NOTIFY) == 0) {
+      // poll fast at first, halts right after resume are common, then back off
+      auto interval = std::chrono::microseconds(200);
+      while (true) {
+        const auto st = status();
+        if (!st) {
+          throw std::runtime_error("cc debugger status failed: " + st.error);
+        }
+        if (st.response & CC_STATUS_CPU_HALTED) {
+          return true;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+          return false;
+        }
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(interval, deadline - now));
+        interval = std::min(interval * 2, std::chrono::microseconds(50000));
+      }
+    }
+
+    while (true) {
+      const auto now = std::chrono::steady_clock::now();
+      const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+      {
+        // with the lock held no request is in flight, anything waiting on
+        // the line is a notification. waits in short slices, so halt()
+        // from another thread gets through in between
+        std::lock_guard<std::mutex> lock(mu);
+        if (!halt_pending && link->wait(std::max<int>(0, std::min<int>(remaining.count(), 50)))) {
+          cc_debugger_response res;
+          link->read(reinterpret_cast<uint8_t *>(&res), sizeof(cc_debugger_response));
+          if (res.ans == ANS_ERROR) {
+            throw std::runtime_error(fmt::format("cc debugger error {:#x} while waiting for halt", res.payload[1]));
+          }
+          if (res.ans != ANS_HALTED) {
+            throw std::runtime_error(fmt::format("cc debugger sent {:#x} while waiting for halt", res.ans));
+          }
+          halt_pending = true;
+        }
+        if (halt_pending) {
+          halt_pending = false;
+          return true;
+        }
+      }
+
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      // std::mutex is not fair, give a waiting halt() time to take the lock
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
   bool cc_debugger::set_breakpoint(uint8_t id, bool enabled, uint16_t addr) {
+    if (breakpoints_known && breakpoints[id].enabled == enabled && (!enabled || breakpoints[id].addr == addr)) {
+      return true; // slot already holds this
+    }
+
     uint8_t c = ((id & 0x3) << 3);
     if (enabled) {
       c |= (1 << 2);
@@ -225,36 +551,112 @@ namespace driver {
   }
 
   bool cc_debugger::add_breakpoint(uint16_t addr) {
-    uint8_t id = 0;
     for (auto &bp : breakpoints) {
       if (bp.addr == addr && bp.enabled) {
         return true;
       }
-      if (!bp.enabled) {
-        break;
+    }
+
+    for (size_t id = 0; id < breakpoints.size(); id++) {
+      if (!breakpoints[id].enabled) {
+        return set_breakpoint(id, true, addr);
       }
-      id++;
     }
 
-    return set_breakpoint(id, true, addr);
+    // all slots taken, callers fall back to stepping
+    return false;
   }
 
   bool cc_debugger::del_breakpoint(uint16_t addr) {
-    uint8_t id = 0;
-    for (auto &bp : breakpoints) {
-      if (bp.addr == addr) {
-        break;
+    for (size_t id = 0; id < breakpoints.size(); id++) {
+      if (breakpoints[id].addr == addr && breakpoints[id].enabled) {
+        return set_breakpoint(id, false, 0x0);
       }
-      id++;
     }
-
-    return set_breakpoint(id, false, 0x0);
+    return false;
   }
 
   void cc_debugger::clear_all_breakpoints() {
+    // skips slots already disabled, once the probe state is known
     for (size_t i = 0; i < breakpoints.size(); i++) {
       set_breakpoint(i, false, 0x0);
     }
+    breakpoints_known = true;
+  }
+
+  void cc_debugger::begin_access() {
+    if (access_active) {
+      return;
+    }
+
+    cc_instr_batch batch;
+    for (auto reg : access_regs) {
+      batch.add(0xE5, reg); // MOV A, reg
+    }
+    batch.add(0xE5, 0x00);       // MOV A, 0x00 ; R0 of bank 0
+    batch.add(0x75, 0xD0, 0x00); // MOV PSW, #0 ; select bank 0 for R0
+
+    const auto res = exec(batch);
+    std::copy(res.begin(), res.begin() + access_regs.size(), access_values.begin());
+    access_r0 = res[access_regs.size()];
+    access_active = true;
+  }
+
+  void cc_debugger::end_access() {
+    if (!access_active) {
+      return;
+    }
+
+    cc_instr_batch batch;
+    batch.add(0x75, 0x00, access_r0); // MOV 0x00, #r0
+    for (size_t i = access_regs.size() - 1; i > 0; i--) {
+      batch.add(0x75, access_regs[i], access_values[i]); // MOV reg, #value
+    }
+    batch.add(0x74, access_values[0]); // MOV A, #acc
+    exec(batch);
+    access_active = false;
+  }
+
+  int cc_debugger::access_index(uint8_t sfr) {
+    if (!access_active) {
+      return -1;
+    }
+    for (size_t i = 0; i < access_regs.size(); i++) {
+      if (access_regs[i] == sfr) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  cc_cpu_regs cc_debugger::read_regs() {
+    // most registers are saved by begin_access already
+    begin_access();
+
+    const uint8_t bank = access_values[2] & 0x18;
+
+    cc_instr_batch batch;
+    batch.add(0xE5, 0x81); // MOV A, SP
+    for (uint8_t n = 0; n < 8; n++) {
+      batch.add(0xE5, bank + n); // MOV A, Rn
+    }
+    const auto res = exec(batch);
+
+    cc_cpu_regs regs;
+    std::copy(res.begin() + 1, res.begin() + 9, regs.r);
+    if (bank == 0) {
+      regs.r[0] = access_r0;
+    }
+    regs.acc = access_values[0];
+    regs.b = access_values[1];
+    regs.psw = access_values[2];
+    regs.sp = res[0];
+    regs.dpl0 = access_values[3];
+    regs.dph0 = access_values[4];
+    regs.dpl1 = access_values[5];
+    regs.dph1 = access_values[6];
+    regs.dps = access_values[7];
+    return regs;
   }
 
   void cc_debugger::set_pc(uint16_t addr) {
@@ -262,161 +664,615 @@ namespace driver {
   }
 
   void cc_debugger::read_data_raw(uint8_t addr, uint8_t *buf, uint32_t size) {
-    stack_guard guard(*this, {
-                                 0xF0, // B
-                                 0x0,  // R0
-                                 0xD0, // PSW
-                             });
+    if (probe_caps & CC_CAP_BLOCK_RW) {
+      read_block(CC_CMD_READ_IRAM_BLOCK, addr, buf, size);
+    } else {
+      begin_access();
 
-    instr(0x78, addr); //MOV  R0, addr;
-    for (int n = 0; n < size; n++) {
-      auto res = instr(0xE6); //MOV A,@R0
-      buf[n] = res.response;
+      cc_instr_batch batch;
+      batch.add(0x78, addr); //MOV  R0, addr;
+      for (uint32_t n = 0; n < size; n++) {
+        batch.add(0xE6); //MOV A,@R0
+        batch.add(0x08); //INC R0
+      }
 
-      instr(0x08); //INC R0
+      const auto res = exec(batch);
+      for (uint32_t n = 0; n < size; n++) {
+        buf[n] = res[1 + n * 2];
+      }
+    }
+
+    // R0 of bank 0 is used as pointer, hand out the saved value
+    for (uint32_t n = 0; n < size && access_active; n++) {
+      if (uint8_t(addr + n) == 0x00) {
+        buf[n] = access_r0;
+      }
     }
   }
 
   void cc_debugger::read_sfr_raw(uint8_t addr, uint8_t *buf, uint32_t size) {
-    stack_guard guard(*this, {
-                                 0xF0, // B
-                                 0xD0, // PSW
-                             });
+    if (probe_caps & CC_CAP_BLOCK_RW) {
+      read_block(CC_CMD_READ_SFR_BLOCK, addr, buf, size);
+    } else {
+      begin_access();
 
-    for (int n = 0; n < size; n++) {
-      const uint8_t a = addr + n;
-      auto res = instr(0xE5, a); //MOV A,addr
-      buf[n] = res.response;
+      cc_instr_batch batch;
+      for (uint32_t n = 0; n < size; n++) {
+        const uint8_t a = addr + n;
+        batch.add(0xE5, a); //MOV A,addr
+      }
+
+      const auto res = exec(batch);
+      std::copy(res.begin(), res.end(), buf);
+    }
+
+    // clobbered registers read back as the program left them
+    for (uint32_t n = 0; n < size; n++) {
+      const int i = access_index(addr + n);
+      if (i >= 0) {
+        buf[n] = access_values[i];
+      }
     }
   }
 
-  void cc_debugger::read_code_raw(uint16_t addr, uint8_t *buf, uint32_t size) {
-    stack_guard guard(*this, {
-                                 0xF0, // B
-                                 0x82, // DPL0
-                                 0x83, // DPH0
-                                 0x84, // DPL1
-                                 0x85, // DPH1
-                                 0x92, // DPS
-                                 0xD0, // PSW
-                             });
+  void cc_debugger::append_crc_routine(std::vector<uint8_t> &routine, uint16_t size) {
+    // CRC-16/CCITT of size bytes of code at DPTR into R7:R6, clobbers R1, R2, R4, R5
+    const size_t loop = routine.size() + 8;
+    routine.insert(routine.end(), {
+                                                      // ; crc = 0xFFFF
+        0x7F, 0xFF,                                   // MOV R7, #0FFH
+        0x7E, 0xFF,                                   // MOV R6, #0FFH
+        0x7A, HIBYTE(size),                           // MOV R2, #imm
+        0x79, LOBYTE(size),                           // MOV R1, #imm
+                                                      // ; x = (crc >> 8) ^ byte; x ^= x >> 4
+        0xE4,                                         // byteLoop: CLR A
+        0x93,                                         // MOVC A, @A+DPTR
+        0xA3,                                         // INC DPTR
+        0x6F,                                         // XRL A, R7
+        0xFD,                                         // MOV R5, A
+        0xC4,                                         // SWAP A
+        0x54, 0x0F,                                   // ANL A, #0FH
+        0x6D,                                         // XRL A, R5
+        0xFD,                                         // MOV R5, A
+                                                      // ; crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x
+        0xC4,                                         // SWAP A
+        0x54, 0xF0,                                   // ANL A, #0F0H
+        0x6E,                                         // XRL A, R6
+        0xFF,                                         // MOV R7, A
+        0xED,                                         // MOV A, R5
+        0x03,                                         // RR A
+        0x03,                                         // RR A
+        0x03,                                         // RR A
+        0xFC,                                         // MOV R4, A
+        0x54, 0x1F,                                   // ANL A, #1FH
+        0x6F,                                         // XRL A, R7
+        0xFF,                                         // MOV R7, A
+        0xEC,                                         // MOV A, R4
+        0x54, 0xE0,                                   // ANL A, #0E0H
+        0x6D,                                         // XRL A, R5
+        0xFE,                                         // MOV R6, A
+    });
+    routine.insert(routine.end(), {
+        0xD9, uint8_t(loop - routine.size() - 2),     // DJNZ R1, byteLoop
+        0xDA, uint8_t(loop - routine.size() - 4),     // DJNZ R2, byteLoop
+    });
+  }
+
+  uint16_t cc_debugger::crc16(const uint8_t *buf, uint32_t size, uint16_t crc) {
+    // CRC-16/CCITT, bytewise so it matches the on-chip routine in page_crc
+    for (uint32_t n = 0; n < size; n++) {
+      uint8_t x = (crc >> 8) ^ buf[n];
+      x ^= x >> 4;
+      crc = (crc << 8) ^ (uint16_t(x) << 12) ^ (uint16_t(x) << 5) ^ x;
+    }
+    return crc;
+  }
+
+  std::vector<uint16_t> cc_debugger::page_crc(uint32_t page, uint32_t count) {
+    const uint16_t page_size = chip_info.page_size;
+    const uint16_t table_addr = 0xF000;
+    const uint16_t routine_addr = 0xF100;
+    const uint32_t max_pages = (routine_addr - table_addr) / 2;
+
+    std::vector<uint16_t> result;
+    result.reserve(count);
+
+    while (count > 0) {
+      const uint32_t addr = page * page_size;
+      const uint8_t bank = (addr >> 15) & 0x03;
+      const uint16_t code_addr = bank ? 0x8000 | (addr & 0x7FFF) : addr;
 
-    const int bank = (addr >> 15) & 0x03;
-    instr(0x75, 0xC7, bank * 16 + 1);
-    addr = addr & 0xFFFF;
+      if (code_addr >= 0xF000) {
+        // sram shadows the top of the code window while the routine runs
+        std::vector<uint8_t> buf(page_size);
+        read_code_raw(addr, buf.data(), buf.size());
+        result.push_back(crc16(buf.data(), buf.size()));
+        page++;
+        count--;
+        continue;
+      }
+
+      // stay inside the bank and below the sram window
+      const uint32_t bank_end = std::min(0x8000u - (addr & 0x7FFF), 0xF000u - code_addr);
+      const uint32_t pages = std::min({count, max_pages, bank_end / page_size});
+
+      std::vector<uint8_t> routine = {
+          0x75, 0x92, 0x00,                             // MOV DPS, #0
+          0x90, HIBYTE(code_addr), LOBYTE(code_addr),   // MOV DPTR, #code_addr
+          0x75, 0x92, 0x01,                             // MOV DPS, #1
+          0x90, HIBYTE(table_addr), LOBYTE(table_addr), // MOV DPTR, #table_addr
+          0x75, 0x92, 0x00,                             // MOV DPS, #0
+          0x7B, uint8_t(pages),                         // MOV R3, #pages
+      };
+      const uint8_t page_loop = routine.size();
+      append_crc_routine(routine, page_size);
+      routine.insert(routine.end(), {
+                                                        // ; store crc big endian
+          0x75, 0x92, 0x01,                             // MOV DPS, #1
+          0xEF,                                         // MOV A, R7
+          0xF0,                                         // MOVX @DPTR, A
+          0xA3,                                         // INC DPTR
+          0xEE,                                         // MOV A, R6
+          0xF0,                                         // MOVX @DPTR, A
+          0xA3,                                         // INC DPTR
+          0x75, 0x92, 0x00,                             // MOV DPS, #0
+      });
+      routine.insert(routine.end(), {
+          0xDB, uint8_t(page_loop - routine.size() - 2), // DJNZ R3, pageLoop
+                                                         // ; Done, fake a breakpoint
+          0xA5                                           // DB 0xA5;
+      });
+
+      write_xdata_raw(routine_addr, routine.data(), routine.size());
+
+      // like the flash routine, this one owns the cpu registers
+      end_access();
+      instr(0x75, 0xC7, 0x41 | (bank * 16)); // MOV MEMCTR, 0x40 | (bank * 16) + 1
+      set_pc(routine_addr);
+      resume();
+
+      if (!wait_for_halt(std::chrono::seconds(5))) {
+        throw std::runtime_error("cc debugger page crc timed out");
+      }
 
-    instr(0x90, HIBYTE(addr), LOBYTE(addr)); //MOV DPTR, addr;
-    for (int n = 0; n < size; n++) {
-      instr(0xE4);            // CLR A
-      auto res = instr(0x93); // MOVC A, @A+DPTR
-      instr(0xA3);            // INC DPTR;
-      buf[n] = res.response;
+      uint8_t table[max_pages * 2];
+      read_xdata_raw(table_addr, table, pages * 2);
+      for (uint32_t n = 0; n < pages; n++) {
+        result.push_back((table[n * 2] << 8) | table[n * 2 + 1]);
+      }
+
+      page += pages;
+      count -= pages;
+    }
+
+    return result;
+  }
+
+  void cc_debugger::read_code_raw(uint32_t addr, uint8_t *buf, uint32_t size) {
+    while (size > 0) {
+      const uint8_t bank = (addr >> 15) & 0x03;
+      const uint32_t count = std::min(0x8000 - (addr & 0x7FFF), size);
+
+      if (bank == 0) {
+        // the lower 32k of flash are mirrored into xdata, MOVX only needs
+        // two instructions per byte and no bank switch
+        read_xdata_raw(addr, buf, count);
+      } else {
+        read_code_bank(bank, 0x8000 | (addr & 0x7FFF), buf, count);
+      }
+
+      addr += count;
+      buf += count;
+      size -= count;
+    }
+  }
+
+  void cc_debugger::read_code_bank(uint8_t bank, uint16_t addr, uint8_t *buf, uint32_t size) {
+    begin_access();
+
+    if (probe_caps & CC_CAP_BLOCK_RW) {
+      instr(0x75, 0xC7, bank * 16 + 1); // MOV MEMCTR, (bank * 16) + 1
+      return read_block(CC_CMD_READ_CODE_BLOCK, addr, buf, size);
+    }
+
+    cc_instr_batch batch;
+    batch.add(0x75, 0xC7, bank * 16 + 1); // MOV MEMCTR, (bank * 16) + 1
+
+    // index from a fixed DPTR, which saves the CLR A and INC DPTR per byte
+    std::vector<size_t> index(size);
+    for (uint32_t n = 0; n < size; n++) {
+      const uint16_t a = addr + n;
+      if (n == 0 || LOBYTE(a) == 0) {
+        batch.add(0x90, HIBYTE(a), 0x00); //MOV DPTR, addr & 0xFF00;
+      }
+      batch.add(0x74, LOBYTE(a)); // MOV A, #(addr & 0xFF)
+      index[n] = batch.add(0x93); // MOVC A, @A+DPTR
+    }
+
+    const auto res = exec(batch);
+    for (uint32_t n = 0; n < size; n++) {
+      buf[n] = res[index[n]];
     }
   }
 
   void cc_debugger::read_xdata_raw(uint16_t addr, uint8_t *buf, uint32_t size) {
-    stack_guard guard(*this, {
-                                 0xF0, // B
-                                 0x82, // DPL0
-                                 0x83, // DPH0
-                                 0x84, // DPL1
-                                 0x85, // DPH1
-                                 0x92, // DPS
-                                 0xD0, // PSW
-                             });
+    if (probe_caps & CC_CAP_BLOCK_RW) {
+      return read_block(CC_CMD_READ_XDATA_BLOCK, addr, buf, size);
+    }
+
+    begin_access();
 
-    instr(0x90, HIBYTE(addr), LOBYTE(addr)); //MOV DPTR, addr;
-    for (int n = 0; n < size; n++) {
-      auto res = instr(0xE0); //MOVX A, @DPTR;
-      buf[n] = res.response;
+    cc_instr_batch batch;
+    batch.add(0x90, HIBYTE(addr), LOBYTE(addr)); //MOV DPTR, addr;
+    for (uint32_t n = 0; n < size; n++) {
+      batch.add(0xE0); //MOVX A, @DPTR;
+      batch.add(0xA3); //INC DPTR;
+    }
 
-      instr(0xA3); //INC DPTR;
+    const auto res = exec(batch);
+    for (uint32_t n = 0; n < size; n++) {
+      buf[n] = res[1 + n * 2];
     }
   }
 
   void cc_debugger::write_data_raw(uint8_t addr, uint8_t *buf, uint32_t size) {
-    stack_guard guard(*this, {
-                                 0xF0, // B
-                                 0x0,  // R0
-                                 0xD0, // PSW
-                             });
+    begin_access();
+
+    cc_instr_batch batch;
+    batch.add(0x78, addr); //MOV  R0, addr;
+    for (uint32_t n = 0; n < size; n++) {
+      if (uint8_t(addr + n) == 0x00) {
+        // R0 is the pointer, its value is written back on restore
+        access_r0 = buf[n];
+      } else {
+        batch.add(0x74, buf[n]); // MOV A, #inputArray[n]
+        batch.add(0xF6);         //MOV @R0,A
+      }
+      batch.add(0x08); //INC R0
+    }
+    exec(batch);
+  }
 
-    instr(0x78, addr); //MOV  R0, addr;
-    for (int n = 0; n < size; n++) {
-      instr(0x74, buf[n]); // MOV A, #inputArray[n]
-      instr(0xF6);         //MOV @R0,A
-      instr(0x08);         //INC R0
+  void cc_debugger::write_sfr_raw(uint8_t addr, uint8_t *buf, uint32_t size) {
+    cc_instr_batch batch;
+    for (uint32_t n = 0; n < size; n++) {
+      const uint8_t a = addr + n;
+      const int i = access_index(a);
+      if (i >= 0) {
+        access_values[i] = buf[n];
+      } else {
+        batch.add(0x75, a, buf[n]); // MOV addr, #inputArray[n]
+      }
     }
+    exec(batch);
   }
 
   void cc_debugger::write_xdata_raw(uint16_t addr, uint8_t *buf, uint32_t size) {
-    stack_guard guard(*this, {
-                                 0xF0, // B
-                                 0x82, // DPL0
-                                 0x83, // DPH0
-                                 0x84, // DPL1
-                                 0x85, // DPH1
-                                 0x92, // DPS
-                                 0xD0, // PSW
-                             });
+    if (probe_caps & CC_CAP_BURST_WRITE) {
+      return write_xdata_burst(addr, buf, size);
+    }
+    write_xdata_instr(addr, buf, size);
+  }
+
+  void cc_debugger::write_xdata_instr(uint16_t addr, const uint8_t *buf, uint32_t size) {
+    if (probe_caps & CC_CAP_BLOCK_RW) {
+      return write_block(CC_CMD_WRITE_XDATA_BLOCK, addr, buf, size);
+    }
+
+    begin_access();
 
-    instr(0x90, HIBYTE(addr), LOBYTE(addr)); //MOV DPTR, addr;
-    for (int n = 0; n < size; n++) {
-      instr(0x74, buf[n]); // MOV A, #inputArray[n]
-      instr(0xF0);         // MOVX @DPTR, A
-      instr(0xA3);         // INC DPTR
+    cc_instr_batch batch;
+    batch.add(0x90, HIBYTE(addr), LOBYTE(addr)); //MOV DPTR, addr;
+    for (uint32_t n = 0; n < size; n++) {
+      batch.add(0x74, buf[n]); // MOV A, #inputArray[n]
+      batch.add(0xF0);         // MOVX @DPTR, A
+      batch.add(0xA3);         // INC DPTR
     }
+    exec(batch);
   }
 
-  void cc_debugger::write_code_raw(uint16_t addr, uint8_t *buf, uint32_t size) {
+  void cc_debugger::burst_arm(uint16_t desc_addr, uint16_t addr, uint32_t len) {
+    const uint16_t DBGDATA = 0xDF62;
+
+    const uint8_t desc[8] = {
+        HIBYTE(DBGDATA), LOBYTE(DBGDATA), // SRCADDR
+        HIBYTE(addr), LOBYTE(addr),       // DESTADDR
+        uint8_t((len >> 8) & 0x1F),       // VLEN = 0, LEN[12:8]
+        LOBYTE(len),                      // LEN[7:0]
+        0x1F,                             // WORDSIZE = 0, TMODE = single, TRIG = DBG_BW
+        0x12,                             // SRCINC = 0, DESTINC = 1, PRIORITY = high
+    };
+    write_xdata_instr(desc_addr, desc, sizeof(desc));
+
+    cc_instr_batch batch;
+    batch.add(0x75, 0xD3, HIBYTE(desc_addr)); // MOV DMA1CFGH, #desc_addr
+    batch.add(0x75, 0xD2, LOBYTE(desc_addr)); // MOV DMA1CFGL, #desc_addr
+    batch.add(0x43, 0xD6, 0x02);              // ORL DMAARM, #0x02
+    exec(batch);
+  }
+
+  void cc_debugger::burst_send(const uint8_t *buf, uint32_t len) {
+    // BURST_WRITE does not need a halted cpu, so this may run alongside a routine
+    cc_pipeline pipeline(*this);
+    for (uint32_t n = 0; n < len; n += max_burst_size) {
+      const uint32_t count = std::min(max_burst_size, len - n);
+      pipeline.push({CC_CMD_BRUSTWR, {HIBYTE(count), LOBYTE(count), 0}}, buf + n, count);
+    }
+    for (const auto &res : pipeline.collect()) {
+      if (res.ans == ANS_ERROR) {
+        throw std::runtime_error(fmt::format("cc debugger burst write error {:#x}", res.payload[1]));
+      }
+    }
+  }
+
+  bool cc_debugger::burst_done() {
+    // the channel disarms itself after the last byte
+    cc_instr_batch check;
+    check.add(0xE5, 0xD6); // MOV A, DMAARM
+    if ((exec(check)[0] & 0x02) == 0) {
+      return true;
+    }
+
+    cc_instr_batch abort;
+    abort.add(0x75, 0xD6, 0x82); // MOV DMAARM, #0x82 ; ABORT channel 1
+    exec(abort);
+    return false;
+  }
+
+  void cc_debugger::write_xdata_burst(uint16_t addr, const uint8_t *buf, uint32_t size) {
+    // the chip stops dma while halted if DMA_PAUSE is set
+    const uint8_t cfg = uint16_t(read_config());
+    if (cfg & CC_CONFIG_DMA_PAUSE) {
+      write_config(cfg & ~CC_CONFIG_DMA_PAUSE);
+    }
+
+    begin_access();
+
+    // dma channel 1 descriptor lives at the top of sram, save what it covers
+    uint8_t saved[8];
+    const uint16_t desc_addr = 0xF000 + chip_info.sram * 1024 - sizeof(saved);
+    read_xdata_raw(desc_addr, saved, sizeof(saved));
+
+    bool done = true;
+    for (uint32_t offset = 0; offset < size && done; offset += max_dma_size) {
+      const uint32_t len = std::min(max_dma_size, size - offset);
+      burst_arm(desc_addr, addr + offset, len);
+      burst_send(buf + offset, len);
+      done = burst_done();
+    }
+
+    // restore the descriptor area, unless it was part of the transfer
+    for (uint32_t i = 0; i < sizeof(saved); i++) {
+      const uint16_t offset = desc_addr + i - addr;
+      if (offset < size) {
+        saved[i] = buf[offset];
+      }
+    }
+    write_xdata_instr(desc_addr, saved, sizeof(saved));
+
+    if (cfg & CC_CONFIG_DMA_PAUSE) {
+      write_config(cfg);
+    }
+    if (!done) {
+      throw std::runtime_error("cc debugger burst write incomplete");
+    }
+  }
+
+  std::vector<uint32_t> cc_debugger::write_code_raw(uint32_t addr, uint8_t *buf, uint32_t size) {
     const uint8_t FLASH_WORD_SIZE = chip_info.word_size;
-    const uint16_t WORDS_PER_FLASH_PAGE = chip_info.page_size / FLASH_WORD_SIZE;
-    const uint8_t imm = ((addr >> 8) / FLASH_WORD_SIZE) & 0x7E;
-
-    uint8_t routine_8[] = {
-        0x75, 0xAD, imm,  // MOV FADDRH, #imm;
-        0x75, 0xAC, 0x00, // MOV FADDRL, #00;
-        0x75, 0xAE, 0x01, // MOV FLC, #01H; // ERASE
-        // ; Wait for flash erase to complete
-        0xE5, 0xAE,                         // eraseWaitLoop: MOV A, FLC;
-        0x20, 0xE7, 0xFB,                   // JB ACC_BUSY, eraseWaitLoop;
-                                            // ; Initialize the data pointer
-        0x90, 0xF0, 0x00,                   // MOV DPTR, #0F000H;
-                                            // ; Outer loops
-        0x7F, HIBYTE(WORDS_PER_FLASH_PAGE), // MOV R7, #imm;
-        0x7E, LOBYTE(WORDS_PER_FLASH_PAGE), // MOV R6, #imm;
-        0x75, 0xAE, 0x02,                   // MOV FLC, #02H; // WRITE
-                                            // ; Inner loops
-        0x7D, FLASH_WORD_SIZE,              // writeLoop: MOV R5, #imm;
-        0xE0,                               // writeWordLoop: MOVX A, @DPTR;
-        0xA3,                               // INC DPTR;
-        0xF5, 0xAF,                         // MOV FWDATA, A;
-        0xDD, 0xFA,                         // DJNZ R5, writeWordLoop;
-                                            // ; Wait for completion
-        0xE5, 0xAE,                         // writeWaitLoop: MOV A, FLC;
-        0x20, 0xE6, 0xFB,                   // JB ACC_SWBSY, writeWaitLoop;
-        0xDE, 0xF1,                         // DJNZ R6, writeLoop;
-        0xDF, 0xEF,                         // DJNZ R7, writeLoop;
-                                            // ; Done, fake a breakpoint
-        0xA5                                // DB 0xA5;
+    const uint16_t page_size = chip_info.page_size;
+    const uint32_t sram_size = chip_info.sram * 1024;
+
+    // FADDR, DPTR and R6 (words) are loaded by the host before each run,
+    // with R3 set the page at DPTR1 is read back into a crc in R7:R6
+    std::vector<uint8_t> routine_8 = {
+        0x75, 0xAE, 0x01,      // MOV FLC, #01H; // ERASE
+                               // ; Wait for flash erase to complete
+        0xE5, 0xAE,            // eraseWaitLoop: MOV A, FLC;
+        0x20, 0xE7, 0xFB,      // JB ACC_BUSY, eraseWaitLoop;
+                               // ; Entry without erase
+        0x75, 0xAE, 0x02,      // MOV FLC, #02H; // WRITE
+                               // ; Inner loops
+        0x7D, FLASH_WORD_SIZE, // writeLoop: MOV R5, #imm;
+        0xE0,                  // writeWordLoop: MOVX A, @DPTR;
+        0xA3,                  // INC DPTR;
+        0xF5, 0xAF,            // MOV FWDATA, A;
+        0xDD, 0xFA,            // DJNZ R5, writeWordLoop;
+                               // ; Wait for completion
+        0xE5, 0xAE,            // writeWaitLoop: MOV A, FLC;
+        0x20, 0xE6, 0xFB,      // JB ACC_SWBSY, writeWaitLoop;
+        0xDE, 0xF1,            // DJNZ R6, writeLoop;
+                               // ; Verify the page
+        0xEB,                  // MOV A, R3;
+        0x60, 0x00,            // JZ done;
+        0x75, 0x92, 0x01,      // MOV DPS, #1;
     };
+    const uint16_t erase_entry = 0;
+    const uint16_t write_entry = 8;
+
+    const size_t verify_jump = routine_8.size() - 4;
+    append_crc_routine(routine_8, page_size);
+    routine_8.insert(routine_8.end(), {
+        0x75, 0x92, 0x00, // MOV DPS, #0;
+                          // ; Done, fake a breakpoint
+        0xA5,             // done: DB 0xA5;
+    });
+    routine_8[verify_jump] = routine_8.size() - 1 - (verify_jump + 1);
 
-    uint8_t write_buffer[chip_info.page_size];
-    memcpy(write_buffer, buf, size);
+    // two staging buffers, the next chunk is transferred while the current
+    // one is programmed. chunks shrink below a page if sram is too small
+    uint32_t chunk = page_size;
+    while (chunk > 256u * FLASH_WORD_SIZE || 2 * chunk + routine_8.size() + 8 > sram_size) {
+      chunk /= 2;
+    }
+    const uint16_t buffers[2] = {0xF000, uint16_t(0xF000 + chunk)};
+    const uint16_t routine_addr = 0xF000 + 2 * chunk;
+    const uint16_t desc_addr = 0xF000 + sram_size - 8;
+
+    // whole pages are erased and written, pad with the erased value
+    const uint32_t base = addr - addr % page_size;
+    std::vector<uint8_t> data(((size + page_size - 1) / page_size) * page_size, 0xFF);
+    memcpy(data.data(), buf, size);
 
-    const uint32_t fill_size = chip_info.page_size - size;
-    if (fill_size > 0) {
-      memset(write_buffer + size, 0xFF, fill_size);
+    // BURST_WRITE can fill a buffer while the cpu runs, without it staging
+    // has to wait for the halt
+    const bool overlap = probe_caps & CC_CAP_BURST_WRITE;
+    const uint8_t cfg = uint16_t(read_config());
+    if (overlap && (cfg & CC_CONFIG_DMA_PAUSE)) {
+      write_config(cfg & ~CC_CONFIG_DMA_PAUSE);
     }
 
-    write_xdata_raw(0xF000, write_buffer, chip_info.page_size);
-    write_xdata_raw(0xF000 + chip_info.page_size, routine_8, sizeof(routine_8));
-    instr(0x75, 0xC7, 0x51); // MOV MEMCTR, (bank * 16) + 1
-    set_pc(0xF000 + chip_info.page_size);
-    resume();
+    write_xdata_raw(routine_addr, routine_8.data(), routine_8.size());
+    write_xdata_raw(buffers[0], data.data(), chunk);
+
+    std::vector<uint32_t> failed;
+
+    const uint32_t chunks = data.size() / chunk;
+    for (uint32_t i = 0; i < chunks; i++) {
+      const uint32_t offset = i * chunk;
+      const uint32_t word = (base + offset) / FLASH_WORD_SIZE;
+      const uint16_t buffer = buffers[i % 2];
+      const bool next = i + 1 < chunks;
+
+      // the last chunk of a page verifies it, unless sram shadows the page
+      const uint32_t page = base + offset - offset % page_size;
+      const uint8_t bank = (page >> 15) & 0x03;
+      const uint16_t code_addr = bank ? 0x8000 | (page & 0x7FFF) : page;
+      const bool page_done = (offset + chunk) % page_size == 0;
+      const bool verify = page_done && code_addr < 0xF000;
+
+      if (overlap && next) {
+        burst_arm(desc_addr, buffers[(i + 1) % 2], chunk);
+      }
+
+      // the routine runs with its own register state, restore first so resume
+      // does not undo the setup below
+      end_access();
+
+      cc_instr_batch batch;
+      batch.add(0x75, 0xC7, 0x41 | ((bank ? bank : 1) * 16)); // MOV MEMCTR, (bank * 16) + 1
+      batch.add(0x75, 0xAD, HIBYTE(word));                     // MOV FADDRH, #imm;
+      batch.add(0x75, 0xAC, LOBYTE(word));                     // MOV FADDRL, #imm;
+      batch.add(0x75, 0x92, 0x01);                             // MOV DPS, #1;
+      batch.add(0x90, HIBYTE(code_addr), LOBYTE(code_addr));   // MOV DPTR, #code_addr;
+      batch.add(0x75, 0x92, 0x00);                             // MOV DPS, #0;
+      batch.add(0x90, HIBYTE(buffer), LOBYTE(buffer));         // MOV DPTR, #buffer;
+      batch.add(0x7E, uint8_t(chunk / FLASH_WORD_SIZE));       // MOV R6, #imm;
+      batch.add(0x7B, verify ? 0x01 : 0x00);                   // MOV R3, #imm;
+      exec(batch);
+
+      set_pc(routine_addr + (offset % page_size ? write_entry : erase_entry));
+      resume();
+
+      if (overlap && next) {
+        burst_send(data.data() + offset + chunk, chunk);
+      }
+
+      if (!wait_for_halt(std::chrono::seconds(5))) {
+        throw std::runtime_error(fmt::format("cc debugger flash write at {:#06x} timed out", base + offset));
+      }
+
+      if (overlap && next && !burst_done()) {
+        throw std::runtime_error("cc debugger burst write incomplete");
+      }
+
+      if (page_done) {
+        const uint8_t *expected = data.data() + (page - base);
+
+        uint16_t crc;
+        if (verify) {
+          cc_instr_batch result;
+          result.add(0xEF); // MOV A, R7
+          result.add(0xEE); // MOV A, R6
+          const auto res = exec(result);
+          crc = (res[0] << 8) | res[1];
+        } else {
+          std::vector<uint8_t> readback(page_size);
+          read_code_raw(page, readback.data(), page_size);
+          crc = crc16(readback.data(), page_size);
+        }
+
+        if (crc != crc16(expected, page_size)) {
+          failed.push_back(page);
+        }
+      }
+
+      if (!overlap && next) {
+        write_xdata_raw(buffers[(i + 1) % 2], data.data() + offset + chunk, chunk);
+      }
+    }
+
+    if (overlap && (cfg & CC_CONFIG_DMA_PAUSE)) {
+      write_config(cfg);
+    }
+    return failed;
+  }
+
+  std::vector<uint32_t> cc_debugger::patch_code_raw(uint32_t addr, uint8_t *buf, uint32_t size) {
+    // staging buffers of at most a page each plus the routine, and the dma descriptor at the end
+    static constexpr uint32_t routine_size = 128;
+    const uint32_t sram_size = chip_info.sram * 1024;
+    const uint16_t workspace_size = std::min<uint32_t>(2 * chip_info.page_size + routine_size, sram_size - 8);
+    const uint16_t desc_addr = 0xF000 + sram_size - 8;
+
+    const uint16_t pc = this->pc();
+    const cc_cpu_regs regs = read_regs();
+    // MEMCTR and DMA1CFG come with the saved access registers
+    const std::array<uint8_t, 11> sfrs = access_values;
+
+    // the flash controller and dma arming the routine and burst writes change,
+    // and IE, interrupts stay off while the routine runs
+    cc_instr_batch save;
+    save.add(0xE5, 0xAC); // MOV A, FADDRL
+    save.add(0xE5, 0xAD); // MOV A, FADDRH
+    save.add(0xE5, 0xAE); // MOV A, FLC
+    save.add(0xE5, 0xD6); // MOV A, DMAARM
+    save.add(0xE5, 0xA8); // MOV A, IE
+    save.add(0xC2, 0xAF); // CLR EA ; no isr may run while flash is written
+    const auto flash = exec(save);
+
+    std::vector<uint8_t> workspace(workspace_size);
+    std::array<uint8_t, 8> desc;
+    read_xdata_raw(0xF000, workspace.data(), workspace.size());
+    read_xdata_raw(desc_addr, desc.data(), desc.size());
+
+    const auto failed = write_code_raw(addr, buf, size);
+
+    write_xdata_raw(0xF000, workspace.data(), workspace.size());
+    write_xdata_raw(desc_addr, desc.data(), desc.size());
+    end_access();
+
+    const uint8_t bank = regs.psw & 0x18;
+
+    cc_instr_batch batch;
+    for (uint8_t n = 0; n < 8; n++) {
+      batch.add(0x75, bank + n, regs.r[n]); // MOV Rn, #value
+    }
+    batch.add(0x75, 0x81, regs.sp);   // MOV SP, #value
+    batch.add(0x75, 0xF0, regs.b);    // MOV B, #value
+    batch.add(0x75, 0x82, regs.dpl0); // MOV DPL0, #value
+    batch.add(0x75, 0x83, regs.dph0); // MOV DPH0, #value
+    batch.add(0x75, 0x84, regs.dpl1); // MOV DPL1, #value
+    batch.add(0x75, 0x85, regs.dph1); // MOV DPH1, #value
+    batch.add(0x75, 0x92, regs.dps);  // MOV DPS, #value
+    for (size_t i = 8; i < access_regs.size(); i++) {
+      batch.add(0x75, access_regs[i], sfrs[i]); // MOV MEMCTR / DMA1CFG, #value
+    }
+    batch.add(0x75, 0xAC, flash[0]);        // MOV FADDRL, #value
+    batch.add(0x75, 0xAD, flash[1]);        // MOV FADDRH, #value
+    batch.add(0x75, 0xAE, flash[2] & 0xFC); // MOV FLC, #value ; without starting an erase or write
+    if (flash[3] & 0x02) {
+      batch.add(0x43, 0xD6, 0x02); // ORL DMAARM, #0x02 ; re-arm channel 1 on the restored DMA1CFG
+    } else {
+      batch.add(0x75, 0xD6, 0x82); // MOV DMAARM, #0x82 ; ABORT channel 1
+    }
+    batch.add(0x75, 0xA8, flash[4]); // MOV IE, #value
+    batch.add(0x75, 0xD0, regs.psw); // MOV PSW, #value
+    batch.add(0x74, regs.acc);       // MOV A, #value
+    exec(batch);
 
-    while (!(status().response & CC_STATUS_CPU_HALTED))
-      ;
+    set_pc(pc);
+    return failed;
   }
 
 } // namespace driver
\ No newline at end of file
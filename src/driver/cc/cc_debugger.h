@@ -1,9 +1,14 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <vector>
 
 #include "serial.h"
 
@@ -26,13 +31,36 @@ namespace driver {
     CC_CMD_RESUME = 0x0E,
     CC_CMD_HALT = 0x0F,
     CC_CMD_SET_BREAKPOINT = 0x10,
+    CC_CMD_EXEC_BATCH = 0x11,
+    CC_CMD_READ_XDATA_BLOCK = 0x12,
+    CC_CMD_READ_IRAM_BLOCK = 0x13,
+    CC_CMD_READ_SFR_BLOCK = 0x14,
+    CC_CMD_READ_CODE_BLOCK = 0x15,
+    CC_CMD_WRITE_XDATA_BLOCK = 0x16,
+    CC_CMD_STEP_N = 0x17,
+    CC_CMD_STEP_REPLACE = 0x18,
     CC_CMD_PING = 0xF0,
   };
 
+  // capabilities advertised by the probe firmware in an ANS_CAPS ping response
+  enum cc_debugger_caps : uint16_t {
+    CC_CAP_EXEC_BATCH = 0x0001,
+    CC_CAP_BLOCK_RW = 0x0002,
+    CC_CAP_HALT_NOTIFY = 0x0004,
+    CC_CAP_BURST_WRITE = 0x0008,
+    CC_CAP_STEP_N = 0x0010,
+    CC_CAP_STEP_REPLACE = 0x0020,
+  };
+
   enum cc_debugger_answer : uint8_t {
     ANS_OK = 0x01,
     ANS_ERROR = 0x02,
     ANS_READY = 0x03,
+    // sent unsolicited once the cpu halts after a resume with notification
+    ANS_HALTED = 0x04,
+    // ping response carrying the capabilities, older firmware answers
+    // ANS_OK with whatever is left in its buffer
+    ANS_CAPS = 0x05,
   };
 
   enum cc_debugger_status : uint8_t {
@@ -46,6 +74,13 @@ namespace driver {
     CC_STATUS_STACK_OVERFLOW = 0x01,
   };
 
+  enum cc_debugger_config : uint8_t {
+    CC_CONFIG_TIMERS_OFF = 0x08,
+    CC_CONFIG_DMA_PAUSE = 0x04,
+    CC_CONFIG_TIMER_SUSPEND = 0x02,
+    CC_CONFIG_SEL_FLASH_INFO_PAGE = 0x01,
+  };
+
   struct cc_debugger_request {
     cc_debugger_cmd cmd;
     uint8_t payload[3];
@@ -65,13 +100,114 @@ namespace driver {
     uint16_t word_size;
   };
 
+  struct cc_debugger_stats {
+    uint64_t frames;
+    uint64_t pipelines;
+    core::transport_stats link;
+  };
+
+  // registers as the program sees them, r holds the active bank
+  struct cc_cpu_regs {
+    uint8_t r[8];
+    uint8_t acc;
+    uint8_t b;
+    uint8_t psw;
+    uint8_t sp;
+    uint8_t dpl0;
+    uint8_t dph0;
+    uint8_t dpl1;
+    uint8_t dph1;
+    uint8_t dps;
+  };
+
   struct cc_breakpoint {
     bool enabled;
     uint16_t addr;
   };
 
+  struct cc_instr {
+    uint8_t length;
+    uint8_t code[3];
+  };
+
+  /** A list of debug instructions executed with a single CC_CMD_EXEC_BATCH frame.
+    The frame header carries the instruction count and the byte length of the
+    instruction stream, every instruction is prefixed by its length.
+    The response carries the accumulator after each instruction.
+  */
+  class cc_instr_batch {
+  public:
+    static constexpr size_t max_size = 64;
+
+    size_t add(uint8_t c1) {
+      return add({1, {c1, 0, 0}});
+    }
+    size_t add(uint8_t c1, uint8_t c2) {
+      return add({2, {c1, c2, 0}});
+    }
+    size_t add(uint8_t c1, uint8_t c2, uint8_t c3) {
+      return add({3, {c1, c2, c3}});
+    }
+
+    size_t add(cc_instr instr) {
+      instrs.push_back(instr);
+      return instrs.size() - 1;
+    }
+
+    size_t size() const {
+      return instrs.size();
+    }
+
+    const std::vector<cc_instr> &get_instrs() const {
+      return instrs;
+    }
+
+  private:
+    std::vector<cc_instr> instrs;
+  };
+
+  class cc_debugger;
+
+  /** Queue of request frames sent to the probe back to back.
+    Up to depth frames are kept in flight, responses are matched in order
+    when collected. The probe stays locked for the lifetime of the pipeline,
+    so the owning cc_debugger must not be used directly until it is destroyed.
+  */
+  class cc_pipeline {
+  public:
+    static constexpr size_t default_depth = 16;
+
+    cc_pipeline(cc_debugger &dev, size_t depth = default_depth);
+
+    size_t push(cc_debugger_request req, const uint8_t *data = nullptr, size_t data_size = 0, uint8_t *out = nullptr, size_t out_size = 0);
+    std::vector<cc_debugger_response> collect();
+
+    size_t size() const {
+      return frames.size();
+    }
+
+  private:
+    struct frame {
+      std::vector<uint8_t> data;
+      uint8_t *out;
+      size_t out_size;
+    };
+
+    cc_debugger &dev;
+    size_t depth;
+    std::unique_lock<std::mutex> lock;
+    std::vector<frame> frames;
+  };
+
   class cc_debugger {
   public:
+    // block commands carry an 8 bit length, 0 meaning 256 bytes
+    static constexpr uint32_t max_block_size = 256;
+    // bytes per burst write frame, limited by the probe buffer
+    static constexpr uint32_t max_burst_size = 1024;
+    // bytes per dma descriptor, the length field is 13 bits wide
+    static constexpr uint32_t max_dma_size = 4096;
+
     struct response_or_error {
       response_or_error() {}
       response_or_error(uint16_t res)
@@ -94,9 +230,15 @@ namespace driver {
       std::string error;
     };
 
-    cc_debugger(std::string port);
+    // port is a tty path, tcp://<host>:<port> or loop:// for the built-in emulator
+    cc_debugger(std::string port, core::serial_config cfg = core::serial_config());
+    cc_debugger(std::unique_ptr<core::transport> link);
 
     bool ping();
+    uint16_t caps();
+
+    cc_debugger_stats stats();
+    void reset_stats();
 
     bool detect();
     cc_chip_info info();
@@ -105,11 +247,20 @@ namespace driver {
     bool exit();
 
     bool step();
+    // execute count instructions and return the pc after the last one,
+    // ends early once stopped returns true, it is polled between batches
+    response_or_error step(uint32_t count, const std::function<bool()> &stopped = nullptr);
+    // execute instr in place of the instruction at the pc, e.g. one
+    // displaced by a software breakpoint. returns the new pc
+    response_or_error step_replace(cc_instr instr);
 
     bool chip_erase();
     bool resume();
     bool halt();
 
+    // block until the cpu halted or timeout expired, returns false on timeout
+    bool wait_for_halt(std::chrono::milliseconds timeout);
+
     bool add_breakpoint(uint16_t addr);
     bool del_breakpoint(uint16_t addr);
     void clear_all_breakpoints();
@@ -119,6 +270,12 @@ namespace driver {
     response_or_error pc();
     void set_pc(uint16_t val);
 
+    // restore the registers clobbered by memory access, done implicitly by resume, step and exit
+    void end_access();
+
+    // all cpu registers with at most two batches
+    cc_cpu_regs read_regs();
+
     response_or_error read_config();
     response_or_error write_config(uint8_t cfg);
 
@@ -126,25 +283,69 @@ namespace driver {
     response_or_error instr(uint8_t c1, uint8_t c2);
     response_or_error instr(uint8_t c1, uint8_t c2, uint8_t c3);
 
+    std::vector<uint8_t> exec(const cc_instr_batch &batch);
+
     void read_data_raw(uint8_t addr, uint8_t *buf, uint32_t size);
     void read_sfr_raw(uint8_t addr, uint8_t *buf, uint32_t size);
     void read_xdata_raw(uint16_t addr, uint8_t *buf, uint32_t size);
-    void read_code_raw(uint16_t addr, uint8_t *buf, uint32_t size);
+    void read_code_raw(uint32_t addr, uint8_t *buf, uint32_t size);
 
     void write_data_raw(uint8_t addr, uint8_t *buf, uint32_t size);
+    void write_sfr_raw(uint8_t addr, uint8_t *buf, uint32_t size);
     void write_xdata_raw(uint16_t addr, uint8_t *buf, uint32_t size);
-    void write_code_raw(uint16_t addr, uint8_t *buf, uint32_t size);
+    // erases and programs whole pages starting at the page of addr,
+    // the tail of the last page is filled with 0xFF.
+    // returns the addresses of pages that failed verification
+    std::vector<uint32_t> write_code_raw(uint32_t addr, uint8_t *buf, uint32_t size);
+    // write_code_raw for a halted program, its registers, pc and the sram
+    // used by the flash routine are put back afterwards
+    std::vector<uint32_t> patch_code_raw(uint32_t addr, uint8_t *buf, uint32_t size);
+
+    // CRC-16/CCITT of count flash pages, computed by a routine run on the chip.
+    // clobbers cpu registers and the start of sram like write_code_raw
+    std::vector<uint16_t> page_crc(uint32_t page, uint32_t count);
+    static uint16_t crc16(const uint8_t *buf, uint32_t size, uint16_t crc = 0xFFFF);
 
   private:
+    friend class cc_pipeline;
+
     static std::map<uint32_t, cc_chip_info> chip_info_map;
     std::mutex mu;
-    core::serial serial;
+    std::unique_ptr<core::transport> link;
     cc_chip_info chip_info;
+    uint16_t probe_caps;
+    bool halt_pending;
+    uint64_t frame_count;
+    uint64_t pipeline_count;
+
+    // registers saved by begin_access, restored before the cpu runs again
+    bool access_active;
+    uint8_t access_r0;
+    std::array<uint8_t, 11> access_values;
+    // slot contents as last sent, unknown until cleared after enter
+    bool breakpoints_known;
     std::array<cc_breakpoint, 4> breakpoints;
 
     bool set_breakpoint(uint8_t id, bool enabled, uint16_t addr);
 
-    cc_debugger_response send(cc_debugger_request req);
+    static void append_crc_routine(std::vector<uint8_t> &routine, uint16_t size);
+    void read_code_bank(uint8_t bank, uint16_t addr, uint8_t *buf, uint32_t size);
+    void read_block(cc_debugger_cmd cmd, uint16_t addr, uint8_t *buf, uint32_t size);
+    void write_block(cc_debugger_cmd cmd, uint16_t addr, const uint8_t *buf, uint32_t size);
+
+    void write_xdata_instr(uint16_t addr, const uint8_t *buf, uint32_t size);
+    void write_xdata_burst(uint16_t addr, const uint8_t *buf, uint32_t size);
+
+    // dma channel 1 moves burst data from DBGDATA to addr, descriptor at desc_addr
+    void burst_arm(uint16_t desc_addr, uint16_t addr, uint32_t len);
+    void burst_send(const uint8_t *buf, uint32_t len);
+    bool burst_done();
+
+    void begin_access();
+    int access_index(uint8_t sfr);
+
+    void read_response(cc_debugger_response &res);
+    cc_debugger_response send(cc_debugger_request req, const uint8_t *data = nullptr, size_t data_size = 0, uint8_t *out = nullptr, size_t out_size = 0);
     response_or_error send_frame(cc_debugger_request req);
   };
 
@@ -0,0 +1,1064 @@
+#include "cc_emulator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define LOBYTE(w) ((uint8_t)(w))
+#define HIBYTE(w) ((uint8_t)(((uint16_t)(w) >> 8) & 0xFF))
+
+namespace driver {
+  enum cc_emulator_sfr : uint8_t {
+    SFR_SP = 0x81,
+    SFR_DPL0 = 0x82,
+    SFR_DPH0 = 0x83,
+    SFR_DPL1 = 0x84,
+    SFR_DPH1 = 0x85,
+    SFR_DPS = 0x92,
+    SFR_MPAGE = 0x93,
+    SFR_FADDRL = 0xAC,
+    SFR_FADDRH = 0xAD,
+    SFR_FLC = 0xAE,
+    SFR_FWDATA = 0xAF,
+    SFR_MEMCTR = 0xC7,
+    SFR_PSW = 0xD0,
+    SFR_DMAIRQ = 0xD1,
+    SFR_DMA1CFGL = 0xD2,
+    SFR_DMA1CFGH = 0xD3,
+    SFR_DMA0CFGL = 0xD4,
+    SFR_DMA0CFGH = 0xD5,
+    SFR_DMAARM = 0xD6,
+    SFR_DMAREQ = 0xD7,
+    SFR_ACC = 0xE0,
+    SFR_B = 0xF0,
+  };
+
+  enum cc_emulator_psw : uint8_t {
+    PSW_CY = 0x80,
+    PSW_AC = 0x40,
+    PSW_OV = 0x04,
+    PSW_P = 0x01,
+  };
+
+  enum cc_emulator_flc : uint8_t {
+    FLC_ERASE = 0x01,
+    FLC_WRITE = 0x02,
+  };
+
+  static constexpr uint16_t X_DBGDATA = 0xDF62;
+  static constexpr uint8_t DMA_TRIG_DBG_BW = 31;
+
+  static constexpr uint16_t flash_page_size = 0x400;
+  static constexpr uint8_t flash_word_size = 2;
+
+  // 8051 instruction lengths, the reserved 0xA5 opcode is used as the debug trap
+  static const uint8_t instr_length[256] = {
+      1, 2, 3, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 00
+      3, 2, 3, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 10
+      3, 2, 1, 1, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 20
+      3, 2, 1, 1, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 30
+      2, 2, 2, 3, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 40
+      2, 2, 2, 3, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 50
+      2, 2, 2, 3, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 60
+      2, 2, 2, 1, 2, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 70
+      2, 2, 2, 1, 1, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 80
+      3, 2, 2, 1, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 90
+      2, 2, 2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // A0
+      2, 2, 2, 1, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, // B0
+      2, 2, 2, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // C0
+      2, 2, 2, 1, 1, 3, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, // D0
+      1, 2, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // E0
+      1, 2, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // F0
+  };
+
+  cc_emulator::cc_emulator(uint16_t chip_id, uint32_t flash_size, uint16_t caps)
+      : chip_id(chip_id)
+      , caps(caps)
+      , config(0)
+      , halted(false)
+      , bp_fetched(false)
+      , notify_halt(false)
+      , flash(flash_size, 0xFF)
+      , xdata(0x10000, 0x00)
+      , flash_word(0) {
+    for (auto &bp : breakpoints) {
+      bp = {false, 0x0};
+    }
+    iram.fill(0);
+    reset();
+  }
+
+  void cc_emulator::reset() {
+    sfr.fill(0);
+    sfr[SFR_SP - 0x80] = 0x07;
+    pc = 0;
+    bp_fetched = false;
+    notify_halt = false;
+    flash_word = 0;
+    for (auto &ch : dma) {
+      ch.armed = false;
+    }
+  }
+
+  void cc_emulator::load(uint32_t addr, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size && addr + i < flash.size(); i++) {
+      flash[addr + i] = data[i];
+    }
+  }
+
+  void cc_emulator::receive(const uint8_t *data, size_t size) {
+    rx.insert(rx.end(), data, data + size);
+    process();
+  }
+
+  size_t cc_emulator::transmit(uint8_t *data, size_t size) {
+    size = std::min(size, tx.size());
+    std::copy(tx.begin(), tx.begin() + size, data);
+    tx.erase(tx.begin(), tx.begin() + size);
+    return size;
+  }
+
+  size_t cc_emulator::pending() const {
+    return tx.size();
+  }
+
+  bool cc_emulator::running() const {
+    return !halted;
+  }
+
+  void cc_emulator::tick(uint32_t count) {
+    for (uint32_t i = 0; i < count && !halted; i++) {
+      // hardware breakpoints halt after the opcode fetch
+      if (!bp_fetched) {
+        for (const auto &bp : breakpoints) {
+          if (bp.enabled && bp.addr == pc) {
+            halted = true;
+            bp_fetched = true;
+            pc++;
+            break;
+          }
+        }
+        if (halted) {
+          break;
+        }
+      }
+      step_cpu();
+    }
+
+    if (halted) {
+      halted_notify();
+    }
+  }
+
+  void cc_emulator::halted_notify() {
+    if (notify_halt) {
+      notify_halt = false;
+      answer(ANS_HALTED, HIBYTE(pc), LOBYTE(pc));
+    }
+  }
+
+  void cc_emulator::process() {
+    while (rx.size() >= sizeof(cc_debugger_request)) {
+      cc_debugger_request req;
+      memcpy(&req, rx.data(), sizeof(cc_debugger_request));
+
+      size_t data_size = 0;
+      switch (req.cmd) {
+      case CC_CMD_EXEC_BATCH:
+        data_size = (req.payload[1] << 8) | req.payload[2];
+        break;
+      case CC_CMD_WRITE_XDATA_BLOCK:
+        data_size = req.payload[2] ? req.payload[2] : 256;
+        break;
+      case CC_CMD_BRUSTWR:
+        data_size = (req.payload[0] << 8) | req.payload[1];
+        break;
+      default:
+        break;
+      }
+
+      const size_t frame_size = sizeof(cc_debugger_request) + data_size;
+      if (rx.size() < frame_size) {
+        return;
+      }
+
+      handle(req, rx.data() + sizeof(cc_debugger_request), data_size);
+      rx.erase(rx.begin(), rx.begin() + frame_size);
+    }
+  }
+
+  void cc_emulator::answer(cc_debugger_answer ans, uint8_t p0, uint8_t p1) {
+    tx.push_back(ans);
+    tx.push_back(p0);
+    tx.push_back(p1);
+  }
+
+  void cc_emulator::handle(const cc_debugger_request &req, const uint8_t *data, size_t data_size) {
+    const uint16_t addr = (req.payload[0] << 8) | req.payload[1];
+    const uint16_t len = req.payload[2] ? req.payload[2] : 256;
+
+    switch (req.cmd) {
+    case CC_CMD_PING:
+      answer(ANS_CAPS, HIBYTE(caps), LOBYTE(caps));
+      break;
+
+    case CC_CMD_ENTER:
+      reset();
+      halted = true;
+      answer(ANS_OK);
+      break;
+
+    case CC_CMD_EXIT:
+      reset();
+      halted = false;
+      answer(ANS_OK);
+      break;
+
+    case CC_CMD_CHIP_ID:
+      answer(ANS_OK, HIBYTE(chip_id), LOBYTE(chip_id));
+      break;
+
+    case CC_CMD_STATUS: {
+      uint8_t status = CC_STATUS_CHIP_ERASE_DONE | CC_STATUS_POWER_MODE_0 | CC_STATUS_OSCILLATOR_STABLE;
+      if (halted) {
+        status |= CC_STATUS_CPU_HALTED;
+      }
+      answer(ANS_OK, 0, status);
+      break;
+    }
+
+    case CC_CMD_PC:
+      answer(ANS_OK, HIBYTE(pc), LOBYTE(pc));
+      break;
+
+    case CC_CMD_STEP:
+      step_cpu();
+      answer(ANS_OK, 0, acc());
+      break;
+
+    case CC_CMD_STEP_N: {
+      if ((caps & CC_CAP_STEP_N) == 0) {
+        answer(ANS_ERROR, 0, req.cmd);
+        break;
+      }
+      const uint16_t count = (req.payload[0] << 8) | req.payload[1];
+      for (uint16_t i = 0; i < count; i++) {
+        step_cpu();
+      }
+      answer(ANS_OK, HIBYTE(pc), LOBYTE(pc));
+      break;
+    }
+
+    case CC_CMD_STEP_REPLACE: {
+      if ((caps & CC_CAP_STEP_REPLACE) == 0) {
+        answer(ANS_ERROR, 0, req.cmd);
+        break;
+      }
+      if (bp_fetched) {
+        pc--;
+        bp_fetched = false;
+      }
+      // runs as if it was fetched at the pc, relative jumps included
+      pc += instr_length[req.payload[0]];
+      execute(req.payload);
+      answer(ANS_OK, HIBYTE(pc), LOBYTE(pc));
+      break;
+    }
+
+    case CC_CMD_EXEC_1:
+    case CC_CMD_EXEC_2:
+    case CC_CMD_EXEC_3:
+      answer(ANS_OK, 0, exec_debug(req.payload));
+      break;
+
+    case CC_CMD_BRUSTWR:
+      if ((caps & CC_CAP_BURST_WRITE) == 0) {
+        answer(ANS_ERROR, 0, req.cmd);
+        break;
+      }
+      burst_write(data, data_size);
+      answer(ANS_OK);
+      break;
+
+    case CC_CMD_RD_CFG:
+      answer(ANS_OK, 0, config);
+      break;
+
+    case CC_CMD_WR_CFG:
+      config = req.payload[0];
+      answer(ANS_OK);
+      break;
+
+    case CC_CMD_CHPERASE:
+      std::fill(flash.begin(), flash.end(), 0xFF);
+      answer(ANS_OK);
+      break;
+
+    case CC_CMD_RESUME:
+      halted = false;
+      notify_halt = (caps & CC_CAP_HALT_NOTIFY) && (req.payload[0] & 0x1);
+      answer(ANS_OK);
+      break;
+
+    case CC_CMD_HALT:
+      halted = true;
+      answer(ANS_OK);
+      halted_notify();
+      break;
+
+    case CC_CMD_SET_BREAKPOINT: {
+      const uint8_t id = (req.payload[0] >> 3) & 0x3;
+      breakpoints[id].enabled = (req.payload[0] >> 2) & 0x1;
+      breakpoints[id].addr = (req.payload[1] << 8) | req.payload[2];
+      answer(ANS_OK);
+      break;
+    }
+
+    case CC_CMD_EXEC_BATCH: {
+      std::vector<uint8_t> results;
+      size_t offset = 0;
+      while (offset < data_size) {
+        const uint8_t length = data[offset];
+        if (length < 1 || length > 3 || offset + 1 + length > data_size) {
+          break;
+        }
+        results.push_back(exec_debug(data + offset + 1));
+        offset += 1 + length;
+      }
+      if (offset != data_size || results.size() != req.payload[0]) {
+        answer(ANS_ERROR, 0, req.cmd);
+        break;
+      }
+      answer(ANS_OK, 0, req.payload[0]);
+      tx.insert(tx.end(), results.begin(), results.end());
+      break;
+    }
+
+    case CC_CMD_READ_XDATA_BLOCK:
+      answer(ANS_OK, 0, req.payload[2]);
+      for (uint16_t i = 0; i < len; i++) {
+        tx.push_back(read_xdata(addr + i));
+      }
+      break;
+
+    case CC_CMD_READ_IRAM_BLOCK:
+      answer(ANS_OK, 0, req.payload[2]);
+      for (uint16_t i = 0; i < len; i++) {
+        tx.push_back(iram[uint8_t(addr + i)]);
+      }
+      break;
+
+    case CC_CMD_READ_SFR_BLOCK:
+      answer(ANS_OK, 0, req.payload[2]);
+      for (uint16_t i = 0; i < len; i++) {
+        tx.push_back(read_direct(uint8_t(addr + i)));
+      }
+      break;
+
+    case CC_CMD_READ_CODE_BLOCK:
+      answer(ANS_OK, 0, req.payload[2]);
+      for (uint16_t i = 0; i < len; i++) {
+        tx.push_back(read_code(addr + i));
+      }
+      break;
+
+    case CC_CMD_WRITE_XDATA_BLOCK:
+      for (uint16_t i = 0; i < len; i++) {
+        write_xdata(addr + i, data[i]);
+      }
+      answer(ANS_OK, 0, req.payload[2]);
+      break;
+
+    default:
+      answer(ANS_ERROR, 0, req.cmd);
+      break;
+    }
+  }
+
+  uint8_t cc_emulator::exec_debug(const uint8_t *code) {
+    // debug instructions do not advance the pc, but jumps still land
+    const uint16_t prev = pc;
+    execute(code);
+    if (pc != prev) {
+      bp_fetched = false;
+    }
+    return acc();
+  }
+
+  void cc_emulator::step_cpu() {
+    if (bp_fetched) {
+      pc--;
+      bp_fetched = false;
+    }
+
+    uint8_t code[3] = {read_code(pc), 0, 0};
+    if (code[0] == 0xA5) {
+      halted = true;
+      pc++;
+      return;
+    }
+
+    const uint8_t length = instr_length[code[0]];
+    for (uint8_t i = 1; i < length; i++) {
+      code[i] = read_code(pc + i);
+    }
+    pc += length;
+    execute(code);
+  }
+
+  uint8_t &cc_emulator::reg(uint8_t n) {
+    return iram[(psw() & 0x18) + n];
+  }
+
+  uint8_t &cc_emulator::acc() {
+    return sfr[SFR_ACC - 0x80];
+  }
+
+  uint8_t &cc_emulator::psw() {
+    return sfr[SFR_PSW - 0x80];
+  }
+
+  uint16_t cc_emulator::dptr() {
+    if (sfr[SFR_DPS - 0x80] & 0x1) {
+      return (sfr[SFR_DPH1 - 0x80] << 8) | sfr[SFR_DPL1 - 0x80];
+    }
+    return (sfr[SFR_DPH0 - 0x80] << 8) | sfr[SFR_DPL0 - 0x80];
+  }
+
+  void cc_emulator::set_dptr(uint16_t val) {
+    if (sfr[SFR_DPS - 0x80] & 0x1) {
+      sfr[SFR_DPH1 - 0x80] = HIBYTE(val);
+      sfr[SFR_DPL1 - 0x80] = LOBYTE(val);
+    } else {
+      sfr[SFR_DPH0 - 0x80] = HIBYTE(val);
+      sfr[SFR_DPL0 - 0x80] = LOBYTE(val);
+    }
+  }
+
+  uint8_t cc_emulator::read_direct(uint8_t addr) {
+    if (addr < 0x80) {
+      return iram[addr];
+    }
+    return sfr[addr - 0x80];
+  }
+
+  void cc_emulator::write_direct(uint8_t addr, uint8_t val) {
+    if (addr < 0x80) {
+      iram[addr] = val;
+      return;
+    }
+
+    switch (addr) {
+    case SFR_FLC:
+      // erase and write complete instantly, so the busy flags never show
+      sfr[addr - 0x80] = val & FLC_WRITE;
+      if (val & FLC_ERASE) {
+        flash_erase_page();
+      }
+      if (val & FLC_WRITE) {
+        flash_word = 0;
+      }
+      break;
+
+    case SFR_DMAARM:
+      sfr[addr - 0x80] = val & 0x1F;
+      dma_arm(val);
+      break;
+
+    case SFR_DMAREQ:
+      for (uint8_t ch = 0; ch < dma.size(); ch++) {
+        if ((val & (1 << ch)) && dma[ch].armed) {
+          dma_transfer(ch);
+        }
+      }
+      break;
+
+    case SFR_FWDATA:
+      sfr[addr - 0x80] = val;
+      if (sfr[SFR_FLC - 0x80] & FLC_WRITE) {
+        flash_write(val);
+      }
+      break;
+
+    default:
+      sfr[addr - 0x80] = val;
+      break;
+    }
+  }
+
+  bool cc_emulator::read_bit(uint8_t bit) {
+    const uint8_t addr = bit < 0x80 ? 0x20 + (bit >> 3) : bit & 0xF8;
+    return (read_direct(addr) >> (bit & 0x7)) & 0x1;
+  }
+
+  void cc_emulator::write_bit(uint8_t bit, bool val) {
+    const uint8_t addr = bit < 0x80 ? 0x20 + (bit >> 3) : bit & 0xF8;
+    const uint8_t mask = 1 << (bit & 0x7);
+    const uint8_t old = read_direct(addr);
+    write_direct(addr, val ? (old | mask) : (old & ~mask));
+  }
+
+  void cc_emulator::push(uint8_t val) {
+    iram[++sfr[SFR_SP - 0x80]] = val;
+  }
+
+  uint8_t cc_emulator::pop() {
+    return iram[sfr[SFR_SP - 0x80]--];
+  }
+
+  uint8_t cc_emulator::read_code(uint16_t addr) {
+    if (addr >= 0xF000 && (sfr[SFR_MEMCTR - 0x80] & 0x40)) {
+      // unified mapping puts sram into code space to run the flash routines
+      return read_xdata(addr);
+    }
+
+    uint32_t offset = addr;
+    if (addr >= 0x8000) {
+      const uint8_t bank = (sfr[SFR_MEMCTR - 0x80] >> 4) & 0x3;
+      offset = bank * 0x8000 + (addr & 0x7FFF);
+    }
+    return offset < flash.size() ? flash[offset] : 0xFF;
+  }
+
+  uint8_t cc_emulator::read_xdata(uint16_t addr) {
+    if (addr >= 0xFF00) {
+      return iram[addr & 0xFF];
+    }
+    if (addr >= 0xF000) {
+      return xdata[addr];
+    }
+    if (addr >= 0xDF80) {
+      return read_direct(addr & 0xFF);
+    }
+    if (addr < 0x8000 && addr < flash.size()) {
+      return flash[addr];
+    }
+    return xdata[addr];
+  }
+
+  void cc_emulator::write_xdata(uint16_t addr, uint8_t val) {
+    if (addr >= 0xFF00) {
+      iram[addr & 0xFF] = val;
+    } else if (addr >= 0xF000) {
+      xdata[addr] = val;
+    } else if (addr >= 0xDF80) {
+      write_direct(addr & 0xFF, val);
+    } else if (addr >= 0x8000 || addr >= flash.size()) {
+      xdata[addr] = val;
+    }
+  }
+
+  void cc_emulator::dma_arm(uint8_t mask) {
+    for (uint8_t ch = 0; ch < dma.size(); ch++) {
+      if ((mask & (1 << ch)) == 0) {
+        continue;
+      }
+
+      // abort disarms the selected channels
+      if (mask & 0x80) {
+        dma[ch].armed = false;
+        continue;
+      }
+      if (dma[ch].armed) {
+        continue;
+      }
+
+      uint16_t desc = 0;
+      if (ch == 0) {
+        desc = (sfr[SFR_DMA0CFGH - 0x80] << 8) | sfr[SFR_DMA0CFGL - 0x80];
+      } else {
+        desc = ((sfr[SFR_DMA1CFGH - 0x80] << 8) | sfr[SFR_DMA1CFGL - 0x80]) + (ch - 1) * 8;
+      }
+
+      // descriptor increment modes 0, 1, 2 and -1
+      static const int8_t inc[4] = {0, 1, 2, -1};
+
+      auto &c = dma[ch];
+      c.armed = true;
+      c.src = (read_xdata(desc + 0) << 8) | read_xdata(desc + 1);
+      c.dst = (read_xdata(desc + 2) << 8) | read_xdata(desc + 3);
+      c.len = ((read_xdata(desc + 4) & 0x1F) << 8) | read_xdata(desc + 5);
+      c.count = 0;
+      c.trigger = read_xdata(desc + 6) & 0x1F;
+      c.block = (read_xdata(desc + 6) >> 5) & 0x1;
+      c.src_inc = inc[(read_xdata(desc + 7) >> 6) & 0x3];
+      c.dst_inc = inc[(read_xdata(desc + 7) >> 4) & 0x3];
+    }
+    sfr[SFR_DMAARM - 0x80] = 0;
+    for (uint8_t ch = 0; ch < dma.size(); ch++) {
+      if (dma[ch].armed) {
+        sfr[SFR_DMAARM - 0x80] |= 1 << ch;
+      }
+    }
+  }
+
+  void cc_emulator::dma_trigger(uint8_t trigger) {
+    for (uint8_t ch = 0; ch < dma.size(); ch++) {
+      if (dma[ch].armed && dma[ch].trigger == trigger) {
+        dma_transfer(ch);
+      }
+    }
+  }
+
+  void cc_emulator::dma_transfer(uint8_t ch) {
+    auto &c = dma[ch];
+    do {
+      write_xdata(c.dst, read_xdata(c.src));
+      c.src += c.src_inc;
+      c.dst += c.dst_inc;
+      c.count++;
+    } while (c.block && c.count < c.len);
+
+    if (c.count >= c.len) {
+      c.armed = false;
+      sfr[SFR_DMAARM - 0x80] &= ~(1 << ch);
+      sfr[SFR_DMAIRQ - 0x80] |= 1 << ch;
+    }
+  }
+
+  void cc_emulator::burst_write(const uint8_t *data, size_t size) {
+    // DMA_PAUSE stops the controller while the cpu is halted
+    if (halted && (config & CC_CONFIG_DMA_PAUSE)) {
+      return;
+    }
+    for (size_t i = 0; i < size; i++) {
+      xdata[X_DBGDATA] = data[i];
+      dma_trigger(DMA_TRIG_DBG_BW);
+    }
+  }
+
+  void cc_emulator::flash_erase_page() {
+    const uint32_t word = (sfr[SFR_FADDRH - 0x80] << 8) | sfr[SFR_FADDRL - 0x80];
+    const uint32_t page = (word * flash_word_size) / flash_page_size;
+    const uint32_t start = std::min<uint32_t>(page * flash_page_size, flash.size());
+    const uint32_t end = std::min<uint32_t>(start + flash_page_size, flash.size());
+    std::fill(flash.begin() + start, flash.begin() + end, 0xFF);
+  }
+
+  void cc_emulator::flash_write(uint8_t val) {
+    uint16_t word = (sfr[SFR_FADDRH - 0x80] << 8) | sfr[SFR_FADDRL - 0x80];
+
+    // programming can only clear bits
+    const uint32_t offset = word * flash_word_size + flash_word;
+    if (offset < flash.size()) {
+      flash[offset] &= val;
+    }
+
+    if (++flash_word == flash_word_size) {
+      flash_word = 0;
+      word++;
+      sfr[SFR_FADDRH - 0x80] = HIBYTE(word);
+      sfr[SFR_FADDRL - 0x80] = LOBYTE(word);
+    }
+  }
+
+  void cc_emulator::add(uint8_t val, bool carry) {
+    const uint8_t a = acc();
+    const uint8_t c = (carry && (psw() & PSW_CY)) ? 1 : 0;
+    const uint16_t res = a + val + c;
+
+    psw() &= ~(PSW_CY | PSW_AC | PSW_OV);
+    if (res > 0xFF) {
+      psw() |= PSW_CY;
+    }
+    if ((a & 0xF) + (val & 0xF) + c > 0xF) {
+      psw() |= PSW_AC;
+    }
+    if ((a ^ res) & (val ^ res) & 0x80) {
+      psw() |= PSW_OV;
+    }
+    acc() = LOBYTE(res);
+  }
+
+  void cc_emulator::subb(uint8_t val) {
+    const uint8_t a = acc();
+    const uint8_t c = (psw() & PSW_CY) ? 1 : 0;
+    const int res = a - val - c;
+
+    psw() &= ~(PSW_CY | PSW_AC | PSW_OV);
+    if (res < 0) {
+      psw() |= PSW_CY;
+    }
+    if ((a & 0xF) - (val & 0xF) - c < 0) {
+      psw() |= PSW_AC;
+    }
+    if ((a ^ val) & (a ^ res) & 0x80) {
+      psw() |= PSW_OV;
+    }
+    acc() = LOBYTE(res);
+  }
+
+  void cc_emulator::execute(const uint8_t *code) {
+    const uint8_t op = code[0];
+    const uint8_t lo = op & 0x0F;
+
+    const auto carry = [&]() -> bool {
+      return psw() & PSW_CY;
+    };
+    const auto set_carry = [&](bool val) {
+      psw() = val ? (psw() | PSW_CY) : (psw() & ~PSW_CY);
+    };
+    const auto jump_rel = [&](uint8_t offset) {
+      pc += int8_t(code[offset]);
+    };
+    const auto call = [&](uint16_t addr) {
+      push(LOBYTE(pc));
+      push(HIBYTE(pc));
+      pc = addr;
+    };
+
+    // operand selected by the low nibble: direct, @R0, @R1 or R0-R7
+    const auto get = [&](uint8_t l) -> uint8_t {
+      if (l == 0x5) {
+        return read_direct(code[1]);
+      }
+      if (l < 0x8) {
+        return iram[reg(l & 0x1)];
+      }
+      return reg(l & 0x7);
+    };
+    const auto set = [&](uint8_t l, uint8_t val) {
+      if (l == 0x5) {
+        write_direct(code[1], val);
+      } else if (l < 0x8) {
+        iram[reg(l & 0x1)] = val;
+      } else {
+        reg(l & 0x7) = val;
+      }
+    };
+    // second operand of the arithmetic and logic groups, 0x4 is immediate
+    const auto src = [&]() -> uint8_t {
+      return lo == 0x4 ? code[1] : get(lo);
+    };
+
+    if (lo == 0x1) {
+      const uint16_t addr = (pc & 0xF800) | ((op & 0xE0) << 3) | code[1];
+      if (op & 0x10) {
+        call(addr); // ACALL
+      } else {
+        pc = addr; // AJMP
+      }
+      parity();
+      return;
+    }
+
+    if (lo >= 0x4) {
+      switch (op >> 4) {
+      case 0x0:
+        if (lo == 0x4) {
+          acc()++;
+        } else {
+          set(lo, get(lo) + 1);
+        }
+        break;
+      case 0x1:
+        if (lo == 0x4) {
+          acc()--;
+        } else {
+          set(lo, get(lo) - 1);
+        }
+        break;
+      case 0x2:
+        add(src(), false);
+        break;
+      case 0x3:
+        add(src(), true);
+        break;
+      case 0x4:
+        acc() |= src();
+        break;
+      case 0x5:
+        acc() &= src();
+        break;
+      case 0x6:
+        acc() ^= src();
+        break;
+      case 0x7:
+        if (lo == 0x4) {
+          acc() = code[1];
+        } else {
+          set(lo, code[lo == 0x5 ? 2 : 1]);
+        }
+        break;
+      case 0x8:
+        if (lo == 0x4) {
+          const uint8_t b = sfr[SFR_B - 0x80];
+          psw() &= ~(PSW_CY | PSW_OV);
+          if (b == 0) {
+            psw() |= PSW_OV;
+          } else {
+            const uint8_t a = acc();
+            acc() = a / b;
+            sfr[SFR_B - 0x80] = a % b;
+          }
+        } else if (lo == 0x5) {
+          write_direct(code[2], read_direct(code[1]));
+        } else {
+          write_direct(code[1], get(lo));
+        }
+        break;
+      case 0x9:
+        subb(src());
+        break;
+      case 0xA:
+        if (lo == 0x4) {
+          const uint16_t res = acc() * sfr[SFR_B - 0x80];
+          psw() &= ~(PSW_CY | PSW_OV);
+          if (res > 0xFF) {
+            psw() |= PSW_OV;
+          }
+          acc() = LOBYTE(res);
+          sfr[SFR_B - 0x80] = HIBYTE(res);
+        } else if (lo >= 0x6) {
+          set(lo, read_direct(code[1]));
+        }
+        break;
+      case 0xB: {
+        uint8_t a, b;
+        if (lo == 0x4) {
+          a = acc();
+          b = code[1];
+        } else if (lo == 0x5) {
+          a = acc();
+          b = read_direct(code[1]);
+        } else {
+          a = get(lo);
+          b = code[1];
+        }
+        set_carry(a < b);
+        if (a != b) {
+          jump_rel(2);
+        }
+        break;
+      }
+      case 0xC:
+        if (lo == 0x4) {
+          acc() = (acc() << 4) | (acc() >> 4);
+        } else {
+          const uint8_t tmp = get(lo);
+          set(lo, acc());
+          acc() = tmp;
+        }
+        break;
+      case 0xD:
+        if (lo == 0x4) {
+          uint16_t a = acc();
+          if ((a & 0x0F) > 9 || (psw() & PSW_AC)) {
+            a += 0x06;
+            if (a > 0xFF) {
+              set_carry(true);
+            }
+            a &= 0xFF;
+          }
+          if ((a & 0xF0) > 0x90 || carry()) {
+            a += 0x60;
+            if (a > 0xFF) {
+              set_carry(true);
+            }
+          }
+          acc() = LOBYTE(a);
+        } else if (lo == 0x6 || lo == 0x7) {
+          uint8_t &mem = iram[reg(lo & 0x1)];
+          const uint8_t tmp = mem & 0x0F;
+          mem = (mem & 0xF0) | (acc() & 0x0F);
+          acc() = (acc() & 0xF0) | tmp;
+        } else {
+          const uint8_t val = get(lo) - 1;
+          set(lo, val);
+          if (val != 0) {
+            jump_rel(lo == 0x5 ? 2 : 1);
+          }
+        }
+        break;
+      case 0xE:
+        if (lo == 0x4) {
+          acc() = 0;
+        } else {
+          acc() = get(lo);
+        }
+        break;
+      case 0xF:
+        if (lo == 0x4) {
+          acc() = ~acc();
+        } else {
+          set(lo, acc());
+        }
+        break;
+      }
+      parity();
+      return;
+    }
+
+    switch (op) {
+    case 0x00: // NOP
+      break;
+    case 0x02: // LJMP
+      pc = (code[1] << 8) | code[2];
+      break;
+    case 0x03: // RR A
+      acc() = (acc() >> 1) | (acc() << 7);
+      break;
+    case 0x10: // JBC bit, rel
+      if (read_bit(code[1])) {
+        write_bit(code[1], false);
+        jump_rel(2);
+      }
+      break;
+    case 0x12: // LCALL
+      call((code[1] << 8) | code[2]);
+      break;
+    case 0x13: { // RRC A
+      const bool c = acc() & 0x01;
+      acc() = (acc() >> 1) | (carry() ? 0x80 : 0x00);
+      set_carry(c);
+      break;
+    }
+    case 0x20: // JB bit, rel
+      if (read_bit(code[1])) {
+        jump_rel(2);
+      }
+      break;
+    case 0x22: // RET
+    case 0x32: { // RETI
+      const uint8_t hi = pop();
+      pc = (hi << 8) | pop();
+      break;
+    }
+    case 0x23: // RL A
+      acc() = (acc() << 1) | (acc() >> 7);
+      break;
+    case 0x30: // JNB bit, rel
+      if (!read_bit(code[1])) {
+        jump_rel(2);
+      }
+      break;
+    case 0x33: { // RLC A
+      const bool c = acc() & 0x80;
+      acc() = (acc() << 1) | (carry() ? 0x01 : 0x00);
+      set_carry(c);
+      break;
+    }
+    case 0x40: // JC rel
+      if (carry()) {
+        jump_rel(1);
+      }
+      break;
+    case 0x42: // ORL dir, A
+      write_direct(code[1], read_direct(code[1]) | acc());
+      break;
+    case 0x43: // ORL dir, #imm
+      write_direct(code[1], read_direct(code[1]) | code[2]);
+      break;
+    case 0x50: // JNC rel
+      if (!carry()) {
+        jump_rel(1);
+      }
+      break;
+    case 0x52: // ANL dir, A
+      write_direct(code[1], read_direct(code[1]) & acc());
+      break;
+    case 0x53: // ANL dir, #imm
+      write_direct(code[1], read_direct(code[1]) & code[2]);
+      break;
+    case 0x60: // JZ rel
+      if (acc() == 0) {
+        jump_rel(1);
+      }
+      break;
+    case 0x62: // XRL dir, A
+      write_direct(code[1], read_direct(code[1]) ^ acc());
+      break;
+    case 0x63: // XRL dir, #imm
+      write_direct(code[1], read_direct(code[1]) ^ code[2]);
+      break;
+    case 0x70: // JNZ rel
+      if (acc() != 0) {
+        jump_rel(1);
+      }
+      break;
+    case 0x72: // ORL C, bit
+      set_carry(carry() || read_bit(code[1]));
+      break;
+    case 0x73: // JMP @A+DPTR
+      pc = dptr() + acc();
+      break;
+    case 0x80: // SJMP rel
+      jump_rel(1);
+      break;
+    case 0x82: // ANL C, bit
+      set_carry(carry() && read_bit(code[1]));
+      break;
+    case 0x83: // MOVC A, @A+PC
+      acc() = read_code(pc + acc());
+      break;
+    case 0x90: // MOV DPTR, #imm
+      set_dptr((code[1] << 8) | code[2]);
+      break;
+    case 0x92: // MOV bit, C
+      write_bit(code[1], carry());
+      break;
+    case 0x93: // MOVC A, @A+DPTR
+      acc() = read_code(dptr() + acc());
+      break;
+    case 0xA0: // ORL C, /bit
+      set_carry(carry() || !read_bit(code[1]));
+      break;
+    case 0xA2: // MOV C, bit
+      set_carry(read_bit(code[1]));
+      break;
+    case 0xA3: // INC DPTR
+      set_dptr(dptr() + 1);
+      break;
+    case 0xB0: // ANL C, /bit
+      set_carry(carry() && !read_bit(code[1]));
+      break;
+    case 0xB2: // CPL bit
+      write_bit(code[1], !read_bit(code[1]));
+      break;
+    case 0xB3: // CPL C
+      set_carry(!carry());
+      break;
+    case 0xC0: // PUSH dir
+      push(read_direct(code[1]));
+      break;
+    case 0xC2: // CLR bit
+      write_bit(code[1], false);
+      break;
+    case 0xC3: // CLR C
+      set_carry(false);
+      break;
+    case 0xD0: // POP dir
+      write_direct(code[1], pop());
+      break;
+    case 0xD2: // SETB bit
+      write_bit(code[1], true);
+      break;
+    case 0xD3: // SETB C
+      set_carry(true);
+      break;
+    case 0xE0: // MOVX A, @DPTR
+      acc() = read_xdata(dptr());
+      break;
+    case 0xE2: // MOVX A, @R0
+    case 0xE3: // MOVX A, @R1
+      acc() = read_xdata((sfr[SFR_MPAGE - 0x80] << 8) | reg(op & 0x1));
+      break;
+    case 0xF0: // MOVX @DPTR, A
+      write_xdata(dptr(), acc());
+      break;
+    case 0xF2: // MOVX @R0, A
+    case 0xF3: // MOVX @R1, A
+      write_xdata((sfr[SFR_MPAGE - 0x80] << 8) | reg(op & 0x1), acc());
+      break;
+    }
+    parity();
+  }
+
+  void cc_emulator::parity() {
+    uint8_t a = acc();
+    a ^= a >> 4;
+    a ^= a >> 2;
+    a ^= a >> 1;
+    psw() = (a & 0x1) ? (psw() | PSW_P) : (psw() & ~PSW_P);
+  }
+
+} // namespace driver
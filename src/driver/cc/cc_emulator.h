@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "cc_debugger.h"
+
+namespace driver {
+
+  /** Host side stand-in for the cc-flasher probe firmware and the attached chip.
+    Request frames are fed in with receive(), answers are collected with transmit().
+    The chip is modelled by a plain 8051 core with the CC flash controller,
+    enough to run the routines the host uploads into SRAM.
+  */
+  class cc_emulator {
+    struct dma_channel {
+      bool armed;
+      uint16_t src;
+      uint16_t dst;
+      uint16_t len;
+      uint16_t count;
+      uint8_t trigger;
+      bool block;
+      int8_t src_inc;
+      int8_t dst_inc;
+    };
+
+  public:
+    static constexpr uint16_t default_caps = CC_CAP_EXEC_BATCH | CC_CAP_BLOCK_RW | CC_CAP_HALT_NOTIFY | CC_CAP_BURST_WRITE | CC_CAP_STEP_N | CC_CAP_STEP_REPLACE;
+
+    cc_emulator(uint16_t chip_id = 0x8100, uint32_t flash_size = 0x4000, uint16_t caps = default_caps);
+
+    void receive(const uint8_t *data, size_t size);
+    size_t transmit(uint8_t *data, size_t size);
+    size_t pending() const;
+
+    // run the cpu for up to count instructions while it is not halted
+    void tick(uint32_t count = 1000);
+    bool running() const;
+
+    void load(uint32_t addr, const uint8_t *data, size_t size);
+
+  private:
+    uint16_t chip_id;
+    uint16_t caps;
+    uint8_t config;
+    bool halted;
+    bool bp_fetched;
+    bool notify_halt;
+    std::array<cc_breakpoint, 4> breakpoints;
+
+    std::vector<uint8_t> rx;
+    std::vector<uint8_t> tx;
+
+    uint16_t pc;
+    std::vector<uint8_t> flash;
+    std::vector<uint8_t> xdata;
+    std::array<uint8_t, 256> iram;
+    std::array<uint8_t, 128> sfr;
+
+    // byte offset of the flash word currently collected through FWDATA
+    uint32_t flash_word;
+
+    std::array<dma_channel, 5> dma;
+
+    void reset();
+    void process();
+    void handle(const cc_debugger_request &req, const uint8_t *data, size_t data_size);
+    void answer(cc_debugger_answer ans, uint8_t p0 = 0, uint8_t p1 = 0);
+    void halted_notify();
+
+    uint8_t exec_debug(const uint8_t *code);
+    void step_cpu();
+    void execute(const uint8_t *code);
+    void parity();
+
+    uint8_t &reg(uint8_t n);
+    uint8_t &acc();
+    uint8_t &psw();
+    uint16_t dptr();
+    void set_dptr(uint16_t val);
+
+    uint8_t read_direct(uint8_t addr);
+    void write_direct(uint8_t addr, uint8_t val);
+    bool read_bit(uint8_t bit);
+    void write_bit(uint8_t bit, bool val);
+    void push(uint8_t val);
+    uint8_t pop();
+
+    uint8_t read_code(uint16_t addr);
+    uint8_t read_xdata(uint16_t addr);
+    void write_xdata(uint16_t addr, uint8_t val);
+
+    void dma_arm(uint8_t mask);
+    void dma_trigger(uint8_t trigger);
+    void dma_transfer(uint8_t ch);
+    void burst_write(const uint8_t *data, size_t size);
+
+    void flash_erase_page();
+    void flash_write(uint8_t val);
+
+    void add(uint8_t val, bool carry);
+    void subb(uint8_t val);
+  };
+
+} // namespace driver
@@ -0,0 +1,74 @@
+#include "cc_loopback.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace driver {
+
+  cc_loopback::cc_loopback(uint16_t caps, std::chrono::milliseconds timeout)
+      : transport(timeout)
+      , emu(0x8100, 0x4000, caps)
+      , last_tick(std::chrono::steady_clock::now()) {
+  }
+
+  cc_emulator &cc_loopback::emulator() {
+    return emu;
+  }
+
+  void cc_loopback::catch_up() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - last_tick).count();
+    last_tick = now;
+
+    // the cpu keeps running while the host sleeps between status polls,
+    // roughly at the 2 instructions per us of a cc2510
+    if (emu.running()) {
+      emu.tick(std::min<int64_t>(elapsed, 100000) * 2);
+    }
+  }
+
+  bool cc_loopback::fill(std::chrono::steady_clock::time_point deadline) {
+    const auto start = std::chrono::steady_clock::now();
+    while (!emu.pending() && emu.running() && std::chrono::steady_clock::now() < deadline) {
+      emu.tick();
+    }
+    _stats.wait_time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    return emu.pending();
+  }
+
+  void cc_loopback::read(uint8_t *data, size_t size, std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    size_t read = 0;
+    while (read < size) {
+      if (!fill(deadline)) {
+        throw std::runtime_error("loopback read timeout");
+      }
+      read += emu.transmit(data + read, size - read);
+      _stats.reads++;
+    }
+    _stats.bytes_read += size;
+  }
+
+  void cc_loopback::write(const struct iovec *iov, size_t count) {
+    catch_up();
+    for (size_t i = 0; i < count; i++) {
+      emu.receive(static_cast<const uint8_t *>(iov[i].iov_base), iov[i].iov_len);
+      _stats.bytes_written += iov[i].iov_len;
+    }
+    _stats.writes++;
+  }
+
+  bool cc_loopback::wait(int timeout_ms) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    if (fill(deadline)) {
+      return true;
+    }
+
+    // nothing will arrive from a halted cpu, but keep the caller's pace
+    std::this_thread::sleep_until(deadline);
+    return false;
+  }
+
+} // namespace driver
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "cc_emulator.h"
+#include "transport.h"
+
+namespace driver {
+
+  /** In-process transport bound to a cc_emulator.
+    Runs the whole cc stack without a probe or any serial syscalls,
+    the emulated cpu only advances while the host waits for data.
+  */
+  class cc_loopback : public core::transport {
+  public:
+    cc_loopback(uint16_t caps = cc_emulator::default_caps, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000));
+
+    using transport::read;
+    void read(uint8_t *data, size_t size, std::chrono::milliseconds timeout) override;
+
+    using transport::write;
+    void write(const struct iovec *iov, size_t count) override;
+
+    bool wait(int timeout_ms) override;
+
+    cc_emulator &emulator();
+
+  private:
+    cc_emulator emu;
+    std::chrono::steady_clock::time_point last_tick;
+
+    void catch_up();
+
+    // run the emulator until it has data or the deadline expires
+    bool fill(std::chrono::steady_clock::time_point deadline);
+  };
+
+} // namespace driver
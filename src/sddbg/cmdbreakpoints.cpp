@@ -1,5 +1,6 @@
 #include "cmdbreakpoints.h"
 
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>
 
@@ -10,6 +11,32 @@
 
 namespace debug {
 
+  /** `break [location] [if cond]', the location defaults to the current one
+  */
+  static bool set_break(ParseCmd::Args cmd, const std::string &condition, bool temporary) {
+    const std::string location = cmd.front() == "if" ? "" : cmd.front();
+    const core::bp_id id = gSession.bpmgr()->set_breakpoint(location, temporary);
+    if (id == core::BP_ID_INVALID) {
+      return false;
+    }
+
+    std::string error;
+    if (!condition.empty() && !gSession.bpmgr()->set_condition(id, condition, error)) {
+      core::log::print("{}\n", error);
+    }
+    return true;
+  }
+
+  /** everything after the `if' token, empty without one
+  */
+  static ParseCmd::Args condition_args(ParseCmd::Args cmd) {
+    auto it = std::find(cmd.begin(), cmd.end(), "if");
+    if (it == cmd.end()) {
+      return {};
+    }
+    return ParseCmd::Args(it + 1, cmd.end());
+  }
+
   bool CmdBreakpoints::show(ParseCmd::Args cmd) {
     return false;
   }
@@ -37,7 +64,7 @@ namespace debug {
 
   */
   bool CmdBreak::direct(ParseCmd::Args cmd) {
-    return gSession.bpmgr()->set_breakpoint(cmd.front()) != core::BP_ID_INVALID;
+    return set_break(cmd, join(condition_args(cmd)), false);
   }
 
   bool CmdBreak::directnoarg() {
@@ -57,13 +84,15 @@ namespace debug {
       core::log::print("\n");
       core::log::print("Multiple breakpoints at one place are permitted, and useful if conditional.\n");
       core::log::print("\n");
+      core::log::print("break ... if <cond> sets a condition, see \"condition\".\n");
+      core::log::print("\n");
       core::log::print("Do \"help breakpoints\" for info on other commands dealing with breakpoints.\n");
     }
     return true;
   }
 
   bool CmdTBreak::direct(ParseCmd::Args cmd) {
-    return gSession.bpmgr()->set_breakpoint(cmd.front(), true) != core::BP_ID_INVALID;
+    return set_break(cmd, join(condition_args(cmd)), true);
   }
 
   bool CmdTBreak::directnoarg() {
@@ -94,6 +123,121 @@ namespace debug {
     return true;
   }
 
+  /** `condition N [expr]'
+    stop at breakpoint N only if expr is non zero, without expr the
+    breakpoint becomes unconditional
+  */
+  bool CmdCondition::direct(ParseCmd::Args cmd) {
+    const core::bp_id id = strtoul(cmd.front().c_str(), 0, 10);
+    cmd.pop_front();
+
+    std::string error;
+    if (!gSession.bpmgr()->set_condition(id, join(cmd), error)) {
+      core::log::print("{}\n", error);
+      return false;
+    }
+    if (cmd.empty()) {
+      core::log::print("Breakpoint {} now unconditional.\n", id);
+    }
+    return true;
+  }
+
+  /** `ignore N count'
+    ignore the next count crossings of breakpoint N
+  */
+  bool CmdIgnore::direct(ParseCmd::Args cmd) {
+    if (cmd.size() != 2) {
+      core::log::print("Argument required (a breakpoint number and a count).\n");
+      return false;
+    }
+
+    const core::bp_id id = strtoul(cmd[0].c_str(), 0, 10);
+    const uint32_t count = strtoul(cmd[1].c_str(), 0, 0);
+    if (!gSession.bpmgr()->set_ignore_count(id, count)) {
+      core::log::print("No breakpoint number {}.\n", id);
+      return false;
+    }
+    core::log::print("Will ignore next {} crossings of breakpoint {}.\n", count, id);
+    return true;
+  }
+
+  /** `trace location [item, item...]'
+    a tracepoint records the items and continues instead of stopping.
+    items are expressions or flat address ranges as addr@len, as for x.
+  */
+  bool CmdTrace::direct(ParseCmd::Args cmd) {
+    const std::string location = cmd.front();
+    cmd.pop_front();
+
+    std::vector<std::string> items;
+    for (auto &item : tokenize(join(cmd), ",")) {
+      const size_t first = item.find_first_not_of(" \t");
+      if (first != std::string::npos) {
+        items.push_back(item.substr(first, item.find_last_not_of(" \t") - first + 1));
+      }
+    }
+
+    const core::bp_id id = gSession.bpmgr()->set_breakpoint(location);
+    if (id == core::BP_ID_INVALID) {
+      return false;
+    }
+
+    std::string error;
+    if (!gSession.bpmgr()->set_trace(id, true, items, "", error)) {
+      core::log::print("{}\n", error);
+      gSession.bpmgr()->clear_breakpoint_id(id);
+      return false;
+    }
+    core::log::print("Tracepoint {} collects {} item{}.\n", id, items.size(), items.size() == 1 ? "" : "s");
+    return true;
+  }
+
+  /** `set trace stream on|off', `set trace size N', `set trace clear'
+  */
+  bool CmdTrace::set(ParseCmd::Args cmd) {
+    if (cmd.empty()) {
+      return false;
+    }
+
+    auto &trace = gSession.bpmgr()->trace();
+    if (cmd.front() == "clear") {
+      trace.clear();
+      return true;
+    }
+    if (cmd.size() != 2) {
+      return false;
+    }
+    if (cmd[0] == "stream") {
+      trace.set_stream(cmd[1] == "on");
+      return true;
+    }
+    if (cmd[0] == "size") {
+      trace.set_capacity(strtoul(cmd[1].c_str(), 0, 0));
+      return true;
+    }
+    return false;
+  }
+
+  bool CmdTrace::info(ParseCmd::Args cmd) {
+    auto &trace = gSession.bpmgr()->trace();
+    core::log::print("{} of {} records, streaming {}.\n", trace.size(), trace.capacity(), trace.streaming() ? "on" : "off");
+    trace.dump();
+    return true;
+  }
+
+  bool CmdTrace::help(ParseCmd::Args cmd) {
+    if (cmd.empty()) {
+      core::log::print("Set a tracepoint at specified line or function.\n");
+      core::log::print("trace LOCATION [ITEM, ITEM...]\n");
+      core::log::print("Items are expressions or memory ranges as ADDRESS@LENGTH, read when the\n");
+      core::log::print("tracepoint is hit before the target continues.\n");
+      core::log::print("\n");
+      core::log::print("\"info trace\" lists the records, \"set trace stream on\" prints them as they come,\n");
+      core::log::print("\"set trace size N\" keeps the last N and \"set trace clear\" drops them.\n");
+    }
+    return true;
+  }
+
   bool CmdEnable::direct(ParseCmd::Args cmd) {
     gSession.bpmgr()->enable_bp(strtoul(cmd.front().c_str(), 0, 10));
     return true;
@@ -41,6 +41,27 @@ namespace debug {
     bool direct(ParseCmd::Args cmd) override;
   };
 
+  class CmdCondition : public CmdShowSetInfoHelp {
+  public:
+    CmdCondition() { name = "CONDition"; }
+    bool direct(ParseCmd::Args cmd) override;
+  };
+
+  class CmdIgnore : public CmdShowSetInfoHelp {
+  public:
+    CmdIgnore() { name = "IGnore"; }
+    bool direct(ParseCmd::Args cmd) override;
+  };
+
+  class CmdTrace : public CmdShowSetInfoHelp {
+  public:
+    CmdTrace() { name = "TRace"; }
+    bool direct(ParseCmd::Args cmd) override;
+    bool set(ParseCmd::Args cmd) override;
+    bool info(ParseCmd::Args cmd) override;
+    bool help(ParseCmd::Args cmd) override;
+  };
+
   class CmdDisable : public CmdShowSetInfoHelp {
   public:
     CmdDisable() { name = "DIsable"; }
@@ -14,6 +14,7 @@
 #include "log.h"
 #include "module.h"
 #include "sddbg.h"
+#include "step_engine.h"
 #include "target.h"
 #include "types.h"
 
@@ -165,6 +166,17 @@ namespace debug {
     return true;
   }
 
+  /** `stepi N'
+	step N assembly instructions, the target runs them in one go
+*/
+  bool CmdStepi::direct(ParseCmd::Args cmd) {
+    const uint32_t count = strtoul(cmd.front().c_str(), 0, 0);
+    core::ADDR addr = gSession.target()->step(count);
+    gSession.contextmgr()->set_context(addr);
+    gSession.contextmgr()->dump();
+    return true;
+  }
+
   /** Continue to the next source line in the current (innermost) stack frame.
 	This is similar to step, but function calls that appear within the line of
 	code are executed without stopping.
@@ -173,39 +185,28 @@ namespace debug {
 	This command is abbreviated n.
 */
   bool CmdNext::directnoarg() {
-    core::ADDR addr = gSession.target()->read_PC();
-
-    std::string module;
-    core::LINE_NUM line;
-    gSession.modulemgr()->get_c_addr(addr, module, line);
-    const auto ctx = gSession.contextmgr()->get_current();
-
-    // keep stepping over asm instructions until we hit another c line in the current function
-    core::LINE_NUM current_line = line;
-    while (line == current_line) {
-      addr = gSession.target()->step();
-      gSession.contextmgr()->set_context(addr);
-
-      core::LINE_NUM new_line;
-      if (gSession.modulemgr()->get_c_addr(addr, module, new_line)) {
-        const auto current_context = gSession.contextmgr()->get_current();
-
-        if (current_context.module == ctx.module && current_context.function == ctx.function)
-          current_line = new_line;
-      }
-    }
-
+    const core::ADDR addr = gSession.stepper()->next();
+    gSession.contextmgr()->set_context(addr);
     gSession.contextmgr()->dump();
     return true;
   }
 
   /** Execute one machine instruction, but if it is a function call, proceed until
 	the function returns.
-
-	@FIXME: change from stepi implementation to proper nexti
 */
   bool CmdNexti::directnoarg() {
-    core::ADDR addr = gSession.target()->step();
+    const core::ADDR addr = gSession.stepper()->next_instr();
+    gSession.contextmgr()->set_context(addr);
+    gSession.contextmgr()->dump();
+    return true;
+  }
+
+  /** `nexti N'
+	execute N machine instructions, calls count as one
+*/
+  bool CmdNexti::direct(ParseCmd::Args cmd) {
+    const uint32_t count = strtoul(cmd.front().c_str(), 0, 0);
+    const core::ADDR addr = gSession.stepper()->next_instr(count);
     gSession.contextmgr()->set_context(addr);
     gSession.contextmgr()->dump();
     return true;
@@ -219,7 +220,7 @@ namespace debug {
     core::log::print("Continuing.\n");
     int i = strtoul(cmd.front().c_str(), 0, 0);
 
-    gSession.target()->run_to_bp(i);
+    gSession.bpmgr()->run_to_bp(i);
     core::ADDR addr = gSession.target()->read_PC();
     gSession.contextmgr()->set_context(addr);
     gSession.contextmgr()->dump();
@@ -230,7 +231,7 @@ namespace debug {
 */
   bool CmdContinue::directnoarg() {
     core::log::print("Continuing.\n");
-    gSession.target()->run_to_bp();
+    gSession.bpmgr()->run_to_bp();
 
     core::ADDR addr = gSession.target()->read_PC();
     gSession.contextmgr()->set_context(addr);
@@ -250,7 +251,7 @@ namespace debug {
     if (gSession.bpmgr()->set_breakpoint("main", true) == core::BP_ID_INVALID)
       core::log::print("failed to set main breakpoint!\n");
 
-    gSession.target()->run_to_bp();
+    gSession.bpmgr()->run_to_bp();
     core::ADDR addr = gSession.target()->read_PC();
     gSession.contextmgr()->set_context(addr);
     gSession.contextmgr()->dump();
@@ -419,10 +420,59 @@ linespec:
     return true;
   }
 
+  /** Continue running until just after the current function returns.
+	The return address is taken from the internal stack and gets a temporary
+	breakpoint, so the function runs at full speed.
+*/
   bool CmdFinish::directnoarg() {
-    core::log::print("Finishing current function\n");
-    // @fixme set a breakpoint at the end of the current function
-    //bp_mgr.set_breakpoint(
+    core::log::print("Run till exit from {}\n", gSession.contextmgr()->get_current().function);
+    const core::ADDR addr = gSession.stepper()->finish();
+    gSession.contextmgr()->set_context(addr);
+    gSession.contextmgr()->dump();
+    return true;
+  }
+
+  /** Continue running until a source line past the current line, in the
+	current stack frame, is reached. Unlike next a jump back in a loop does
+	not stop.
+*/
+  bool CmdUntil::directnoarg() {
+    const core::ADDR addr = gSession.stepper()->until();
+    gSession.contextmgr()->set_context(addr);
+    gSession.contextmgr()->dump();
+    return true;
+  }
+
+  /** `until LOCATION'
+	Continue running until LOCATION is reached in the current frame or the
+	current function returns.
+*/
+  bool CmdUntil::direct(ParseCmd::Args cmd) {
+    const core::line_spec ls = core::line_spec::create(&gSession, join(cmd));
+    if (!ls.valid()) {
+      core::log::print("Invalid location \"{}\"\n", join(cmd));
+      return true;
+    }
+
+    const core::ADDR addr = gSession.stepper()->run_to(ls.addr, true);
+    gSession.contextmgr()->set_context(addr);
+    gSession.contextmgr()->dump();
+    return true;
+  }
+
+  /** `advance LOCATION'
+	Like until LOCATION, but also stops in deeper calls of the current function.
+*/
+  bool CmdAdvance::direct(ParseCmd::Args cmd) {
+    const core::line_spec ls = core::line_spec::create(&gSession, join(cmd));
+    if (!ls.valid()) {
+      core::log::print("Invalid location \"{}\"\n", join(cmd));
+      return true;
+    }
+
+    const core::ADDR addr = gSession.stepper()->run_to(ls.addr, false);
+    gSession.contextmgr()->set_context(addr);
+    gSession.contextmgr()->dump();
     return true;
   }
 
@@ -490,45 +540,29 @@ linespec:
 				SP  : 0x07
 				PSW : 0x00 | CY : 0 | AC : 0 | OV : 0 | P : 0
 		*/
-      unsigned char reg_psw, reg_acc, reg_b, reg_dpl, reg_dph, reg_sp;
-      unsigned char reg_set[8], reg_bank;
-      uint16_t reg_dptr;
-      gSession.target()->read_sfr(0xd0, 1, &reg_psw);
-      reg_bank = (reg_psw >> 3) & 0x03;
-      core::log::printf("PC  : 0x%04x  RegisterBank %i:\n",
-                        gSession.target()->read_PC(), reg_bank);
+      const auto state = gSession.target()->read_cpu_state();
+      const uint8_t reg_bank = (state.psw >> 3) & 0x03;
+      core::log::printf("PC  : 0x%04x  RegisterBank %i:\n", state.pc, reg_bank);
 
       // dump the regs
-      gSession.target()->read_data(reg_bank * 8, 8, reg_set);
       core::log::printf("R0-7:");
       for (int i = 0; i < 8; i++)
-        core::log::printf(" 0x%02x", reg_set[i]);
+        core::log::printf(" 0x%02x", state.r[i]);
       core::log::printf("\n");
 
-      // ACC
-      gSession.target()->read_sfr(0xe0, 1, &reg_acc);
-      core::log::printf("ACC : 0x%02x %i %c\n", reg_acc, reg_acc, isprint(reg_acc) ? reg_acc : '.');
-
-      // B
-      gSession.target()->read_sfr(0xf0, 1, &reg_b);
-      core::log::printf("B   : 0x%02x %i %c\n", reg_b, reg_b, isprint(reg_b) ? reg_b : '.');
+      core::log::printf("ACC : 0x%02x %i %c\n", state.acc, state.acc, isprint(state.acc) ? state.acc : '.');
+      core::log::printf("B   : 0x%02x %i %c\n", state.b, state.b, isprint(state.b) ? state.b : '.');
 
-      // DPTR
-      gSession.target()->read_sfr(0x82, 1, &reg_dpl);
-      gSession.target()->read_sfr(0x83, 1, &reg_dph);
-      reg_dptr = (uint16_t(reg_dph) << 8) | reg_dpl;
+      const uint16_t reg_dptr = (uint16_t(state.dph0) << 8) | state.dpl0;
       core::log::printf("DPTR: 0x%04x %i\n", reg_dptr, reg_dptr);
-
-      // SP
-      gSession.target()->read_sfr(0x81, 1, &reg_sp);
-      core::log::printf("SP  : 0x%02x\n", reg_sp);
+      core::log::printf("SP  : 0x%02x\n", state.sp);
 
       core::log::printf("PSW : 0x%02x | CY : %i | AC : %i | OV : %i | P : %i\n",
-                        reg_psw,
-                        (reg_psw >> 7) & 1, // CY
-                        (reg_psw >> 6) & 1, // AC
-                        (reg_psw >> 2) & 1, // OV
-                        reg_psw & 1);       // P
+                        state.psw,
+                        (state.psw >> 7) & 1, // CY
+                        (state.psw >> 6) & 1, // AC
+                        (state.psw >> 2) & 1, // OV
+                        state.psw & 1);       // P
       return true;
     }
     return false;
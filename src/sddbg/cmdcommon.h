@@ -52,6 +52,7 @@ namespace debug {
   class CmdStepi : public CmdShowSetInfoHelp {
   public:
     CmdStepi() { name = "STEPI"; }
+    bool direct(ParseCmd::Args cmd) override;
     bool directnoarg();
   };
 
@@ -64,6 +65,7 @@ namespace debug {
   class CmdNexti : public CmdShowSetInfoHelp {
   public:
     CmdNexti() { name = "NEXTI"; }
+    bool direct(ParseCmd::Args cmd) override;
     bool directnoarg();
   };
 
@@ -141,6 +143,19 @@ namespace debug {
     bool directnoarg();
   };
 
+  class CmdUntil : public CmdShowSetInfoHelp {
+  public:
+    CmdUntil() { name = "Until"; }
+    bool direct(ParseCmd::Args cmd) override;
+    bool directnoarg();
+  };
+
+  class CmdAdvance : public CmdShowSetInfoHelp {
+  public:
+    CmdAdvance() { name = "ADVance"; }
+    bool direct(ParseCmd::Args cmd) override;
+  };
+
   class CmdPrint : public CmdShowSetInfoHelp {
   public:
     CmdPrint() { name = "Print"; }
@@ -241,18 +241,13 @@ namespace debug {
 
     case core::target_addr::AS_CODE:
     case core::target_addr::AS_CODE_STATIC:
-      gSession.target()->read_code(addr.addr, readByteLength, returnPointer);
-      return true;
-
     case core::target_addr::AS_ISTACK:
     case core::target_addr::AS_IRAM_LOW:
     case core::target_addr::AS_INT_RAM:
-      gSession.target()->read_data(addr.addr, readByteLength, returnPointer);
-      return true;
-
     case core::target_addr::AS_XSTACK:
     case core::target_addr::AS_EXT_RAM:
-      gSession.target()->read_xdata(addr.addr, readByteLength, returnPointer);
+      // through the cache, sees writes not yet synced
+      gSession.target()->read_memory(addr, readByteLength, returnPointer);
       return true;
 
     case core::target_addr::AS_SFR:
@@ -309,29 +304,20 @@ namespace debug {
   }
 
   bool CmdChange::writeMem(uint32_t flat_addr, unsigned int byteLength, unsigned char *writePointer) {
-    unsigned char b;
-    char area;
     core::target_addr addr = core::mem_remap::target(flat_addr);
-    switch (area) {
-    case 'c':
+    switch (addr.space) {
+    case core::target_addr::AS_CODE:
+    case core::target_addr::AS_CODE_STATIC:
       // can't write code memory, so return false
       core::log::printf("ERROR: can't write to code area\n");
       return false;
-    case 'd':
-      gSession.target()->write_data(addr.addr, byteLength, writePointer);
-      return true;
-    case 'x':
-      gSession.target()->write_xdata(addr.addr, byteLength, writePointer);
-      return true;
-    case 'i':
-      gSession.target()->write_data(addr.addr + 0x100, byteLength, writePointer); // @FIXME: the offset is incorrect and we probably need a target function for accessing idata
-      return true;
-    case 's':
-      gSession.target()->write_sfr(addr.addr, 0, byteLength, writePointer);
-      return true;
-    default:
-      core::log::printf("ERROR: invalid memory area '%c'\n", area);
+    case core::target_addr::AS_UNDEF:
+      core::log::printf("ERROR: invalid memory area\n");
       return false;
+    default:
+      // held back until the target runs again
+      gSession.target()->write_memory(addr, byteLength, writePointer);
+      return true;
     }
   }
 
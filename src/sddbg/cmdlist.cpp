@@ -26,6 +26,9 @@ namespace debug {
     add(new CmdEnable());
     add(new CmdDisable());
     add(new CmdClear());
+    add(new CmdCondition());
+    add(new CmdIgnore());
+    add(new CmdTrace());
     add(new CmdTarget());
     add(new CmdStep());
     add(new CmdStepi());
@@ -43,6 +46,8 @@ namespace debug {
     add(new CmdRun());
     add(new CmdStop());
     add(new CmdFinish());
+    add(new CmdUntil());
+    add(new CmdAdvance());
     add(new CmdDisassemble());
     add(new CmdX());
     add(new CmdChange());
@@ -8,6 +8,7 @@
 #include "sddbg.h"
 #include "sym_tab.h"
 #include "sym_type_tree.h"
+#include "target.h"
 
 namespace debug {
 
@@ -42,6 +43,15 @@ namespace debug {
         gSession.symtree()->dump();
         return true;
       }
+      if (match(s, "cache")) {
+        const char *names[] = {"iram", "sfr", "xdata", "code"};
+        const auto &cache = gSession.target()->cache();
+        for (int i = 0; i < core::mem_cache::SPACE_COUNT; i++) {
+          const auto stats = cache.get_stats(core::mem_cache::space(i));
+          core::log::print(" {:>6}: {} hits, {} misses\n", names[i], stats.hits, stats.misses);
+        }
+        return true;
+      }
       return false;
     }
 
@@ -13,6 +13,7 @@
 #include "log.h"
 #include "module.h"
 #include "registers.h"
+#include "step_engine.h"
 #include "sym_tab.h"
 #include "sym_type_tree.h"
 #include "target.h"
@@ -118,6 +119,17 @@ namespace debug {
     return var;
   }
 
+  // read the memory of all symbols at once, formatting them then hits the cache
+  static void prefetch_symbols(const std::vector<core::symbol *> &symbols) {
+    std::vector<core::mem_range> ranges;
+    for (auto sym : symbols) {
+      if (sym->length() > 0) {
+        ranges.push_back({sym->addr(), uint32_t(sym->length()), nullptr});
+      }
+    }
+    gSession.target()->read_memory_v(ranges);
+  }
+
   dap::ResponseOrError<dap::VariablesResponse> dap_server::handle(const dap::VariablesRequest &request) {
     std::unique_lock<std::mutex> lock(mutex);
 
@@ -126,21 +138,27 @@ namespace debug {
 
     switch (request.variablesReference) {
     case localVariablesReferenceId: {
-      auto symbols = gSession.symtab()->get_symbols(ctx);
-      for (auto sym : symbols) {
+      std::vector<core::symbol *> locals;
+      for (auto sym : gSession.symtab()->get_symbols(ctx)) {
         if (sym->get_scope().typ == core::symbol_scope::GLOBAL) {
           continue;
         }
+        locals.push_back(sym);
+      }
+
+      prefetch_symbols(locals);
+      for (auto sym : locals) {
         response.variables.push_back(variable_from_symbol(ctx, sym));
       }
       break;
     }
 
     case registerVariablesReferenceId: {
+      const auto state = gSession.target()->read_cpu_state();
       for (auto &reg : gSession.regs()->get_registers()) {
         dap::Variable var;
         var.name = reg.str;
-        var.value = gSession.regs()->print(reg.name);
+        var.value = gSession.regs()->print(state, reg.name);
         var.type = "char";
 
         response.variables.push_back(var);
@@ -156,6 +174,7 @@ namespace debug {
       if (sym == nullptr) {
         return dap::Error("Unknown variablesReference '%d'", lower_ref);
       }
+      prefetch_symbols({sym});
 
       if (upper_ref) {
         const auto type = dynamic_cast<core::sym_type_struct *>(gSession.symtree()->get_type(sym->type_name(), ctx));
@@ -353,18 +372,41 @@ namespace debug {
     auto breakpoints = request.breakpoints.value({});
     response.breakpoints.resize(breakpoints.size());
 
-    gSession.bpmgr()->clear_all();
-
     auto ctx = gSession.contextmgr()->get_current();
-    for (size_t i = 0; i < breakpoints.size(); i++) {
-      const auto &bp = breakpoints[i];
-      const std::string module = request.source.name.value(ctx.module + ".c");
+    const std::string module = request.source.name.value(ctx.module + ".c");
 
-      auto bp_id = gSession.bpmgr()->set_breakpoint(module + ":" + std::to_string(bp.line));
-      response.breakpoints[i].verified = bp_id != core::BP_ID_INVALID;
+    std::vector<std::string> specs;
+    for (const auto &bp : breakpoints) {
+      specs.push_back(module + ":" + std::to_string(bp.line));
     }
 
-    gSession.bpmgr()->reload_all();
+    const auto ids = gSession.bpmgr()->sync_source(module, specs);
+    for (size_t i = 0; i < ids.size(); i++) {
+      response.breakpoints[i].verified = ids[i] != core::BP_ID_INVALID;
+      if (ids[i] == core::BP_ID_INVALID) {
+        continue;
+      }
+
+      // a log message makes it a tracepoint collecting the {expr} in it
+      const std::string message = breakpoints[i].logMessage.value("");
+      std::vector<std::string> items;
+      for (size_t pos = message.find('{'); pos != std::string::npos; pos = message.find('{', pos + 1)) {
+        const size_t end = message.find('}', pos);
+        if (end == std::string::npos) {
+          break;
+        }
+        items.push_back(message.substr(pos + 1, end - pos - 1));
+      }
+
+      // compiled once here, evaluated on the host at every hit
+      std::string error;
+      if (!gSession.bpmgr()->set_condition(ids[i], breakpoints[i].condition.value(""), error) ||
+          !gSession.bpmgr()->set_hit_condition(ids[i], breakpoints[i].hitCondition.value(""), error) ||
+          !gSession.bpmgr()->set_trace(ids[i], breakpoints[i].logMessage.has_value(), items, message, error)) {
+        response.breakpoints[i].verified = false;
+        response.breakpoints[i].message = error;
+      }
+    }
 
     return response;
   };
@@ -386,6 +428,9 @@ namespace debug {
       return dap::Error(e.what());
     }
 
+    // logpoints show up as output events through the logger
+    gSession.bpmgr()->trace().set_stream(true);
+
     gSession.modulemgr()->reset();
     gSession.symtab()->clear();
     gSession.symtree()->clear();
@@ -479,6 +524,9 @@ namespace debug {
     session->registerHandler([](const dap::InitializeRequest &) {
       dap::InitializeResponse response;
       response.supportsConfigurationDoneRequest = true;
+      response.supportsConditionalBreakpoints = true;
+      response.supportsHitConditionalBreakpoints = true;
+      response.supportsLogPoints = true;
       return response;
     });
 
@@ -539,51 +587,28 @@ namespace debug {
 
       switch (state) {
       case state_event::CONTINUE: {
-        gSession.target()->run_to_bp();
-        gSession.contextmgr()->update_context();
-        gSession.contextmgr()->dump();
+        gSession.bpmgr()->run_to_bp();
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          gSession.contextmgr()->update_context();
+        }
 
+        // report the halt first, the client requests the stack right away
         dap::StoppedEvent event;
         event.reason = "breakpoint";
         event.threadId = threadId;
         session->send(event);
+
+        gSession.contextmgr()->dump();
         break;
       }
       case state_event::NEXT: {
-        const auto ctx = gSession.contextmgr()->update_context();
-        auto curr_ctx = ctx;
-
-        core::symbol *function = gSession.symtab()->get_symbol(ctx, ctx.function);
-        if (function && function->end_addr() == ctx.addr) {
-          // we are already at the end of current function,
-          // step and update context to reach the next line
-          gSession.target()->step();
-          curr_ctx = gSession.contextmgr()->update_context();
-          gSession.contextmgr()->dump();
-        }
-
-        while (curr_ctx.c_line == ctx.c_line) {
-          if (gSession.target()->check_stop_forced()) {
-            break;
-          }
-
-          gSession.target()->step();
-          const auto new_ctx = gSession.contextmgr()->update_context();
-          gSession.contextmgr()->dump();
-
-          if (new_ctx.c_line == core::INVALID_LINE) {
-            continue;
-          }
-
-          if (new_ctx.in_interrupt_handler != ctx.in_interrupt_handler) {
-            // bail if we suddently step in into isr
-            break;
-          }
-
-          if (new_ctx.module == ctx.module && new_ctx.function == ctx.function) {
-            curr_ctx = new_ctx;
-          }
+        gSession.stepper()->next();
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          gSession.contextmgr()->update_context();
         }
+        gSession.contextmgr()->dump();
 
         dap::StoppedEvent event;
         event.reason = "step";
@@ -603,30 +628,12 @@ namespace debug {
         break;
       }
       case state_event::STEP_OUT: {
-        auto stack = gSession.contextmgr()->get_stack();
-        if (stack.size() <= 1) {
-          // no function to step out of, do normal step
-          do_continue.fire(state_event::STEP_IN);
-          break;
-        }
-
-        auto current_ctx = stack[0];
-        const auto target_ctx = stack[1];
-
-        while (target_ctx.module != current_ctx.module || target_ctx.function != current_ctx.function) {
-          if (gSession.target()->check_stop_forced()) {
-            break;
-          }
-
-          gSession.target()->step();
-          current_ctx = gSession.contextmgr()->update_context();
-          gSession.contextmgr()->dump();
-
-          if (target_ctx.in_interrupt_handler != current_ctx.in_interrupt_handler) {
-            // bail if we suddently step in into isr
-            break;
-          }
+        gSession.stepper()->finish();
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          gSession.contextmgr()->update_context();
         }
+        gSession.contextmgr()->dump();
 
         dap::StoppedEvent event;
         event.reason = "step";
@@ -0,0 +1,141 @@
+#include <cstdlib>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "ihex.h"
+
+#include "cc_emulator.h"
+
+// stand-in for the cc-flasher firmware, hosts the probe protocol on a pty
+// so cc-tool and sddbg can be pointed at it instead of /dev/ttyACM0
+
+int open_pty(std::string &name) {
+  const int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+    return -1;
+  }
+
+  struct termios tio;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+
+  name = ptsname(fd);
+  return fd;
+}
+
+int main(int argc, char *argv[]) {
+  uint16_t caps = driver::cc_emulator::default_caps;
+  const char *image = nullptr;
+  const char *link = nullptr;
+
+  static struct option long_options[] = {
+      {"caps", required_argument, 0, 'c'},
+      {"load", required_argument, 0, 'l'},
+      {"link", required_argument, 0, 'n'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'c':
+      caps = strtoul(optarg, nullptr, 0);
+      break;
+    case 'l':
+      image = optarg;
+      break;
+    case 'n':
+      link = optarg;
+      break;
+    default:
+      fmt::print("usage: cc-emu [--caps=<mask>] [--load=<file.ihx>] [--link=<path>]\n");
+      return c == 'h' ? 0 : -1;
+    }
+  }
+
+  driver::cc_emulator emu(0x8100, 0x4000, caps);
+
+  if (image) {
+    std::vector<uint8_t> data(0x10000, 0xFF);
+    uint32_t start = 0, end = 0;
+    if (!ihex_load_file(image, (char *)data.data(), &start, &end)) {
+      fmt::print("failed to load {}\n", image);
+      return -1;
+    }
+    emu.load(start, data.data() + start, end - start);
+  }
+
+  std::string name;
+  const int fd = open_pty(name);
+  if (fd < 0) {
+    fmt::print("failed to open pty\n");
+    return -1;
+  }
+
+  // keep the slave side open, otherwise the master reports a hangup
+  // every time a client disconnects
+  const int slave = open(name.c_str(), O_RDWR | O_NOCTTY);
+
+  if (link) {
+    unlink(link);
+    if (symlink(name.c_str(), link) < 0) {
+      fmt::print("failed to link {} to {}\n", link, name);
+      return -1;
+    }
+    name = link;
+  }
+  fmt::print("cc-emu listening on {} (caps {:#06x})\n", name, caps);
+
+  uint8_t buf[512];
+  while (1) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (emu.pending()) {
+      pfd.events |= POLLOUT;
+    }
+
+    // spin while the cpu runs, the host polls status in the meantime
+    if (poll(&pfd, 1, emu.running() ? 0 : 100) < 0) {
+      break;
+    }
+
+    if (pfd.revents & POLLIN) {
+      const ssize_t n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        emu.receive(buf, n);
+      }
+    }
+
+    emu.tick();
+
+    if (emu.pending()) {
+      const size_t size = emu.transmit(buf, sizeof(buf));
+      size_t offset = 0;
+      while (offset < size) {
+        const ssize_t n = write(fd, buf + offset, size - offset);
+        if (n > 0) {
+          offset += n;
+        }
+      }
+    }
+  }
+
+  if (link) {
+    unlink(link);
+  }
+  close(slave);
+  close(fd);
+  return 0;
+}
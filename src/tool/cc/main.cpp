@@ -1,5 +1,6 @@
 #include <chrono>
 #include <thread>
+#include <vector>
 
 #include <fmt/format.h>
 
@@ -74,11 +75,50 @@ void write_flash(driver::cc_debugger &dev) {
 
   dev.enter();
 
-  for (int i = start; i < end; i += page_size) {
-    dev.write_code_raw(i, data + i, page_size);
+  for (const auto page : dev.write_code_raw(start, data + start, end - start)) {
+    fmt::print("verify failed for page at {:#06x}\n", page);
   }
 }
 
+template <typename F>
+void bench_read(driver::cc_debugger &dev, const char *name, uint32_t size, F read) {
+  const int rounds = 4;
+
+  dev.reset_stats();
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    read();
+  }
+  const auto end = std::chrono::steady_clock::now();
+  const auto stats = dev.stats();
+
+  const double secs = std::chrono::duration<double>(end - start).count();
+  fmt::print("{:>8} : {:6} bytes {:8.3f} ms {:8.2f} KB/s, {} frames in {} pipelines, {} us waiting\n",
+             name, size, secs * 1000 / rounds, (size * rounds) / secs / 1024,
+             stats.frames / rounds, stats.pipelines / rounds, stats.link.wait_time.count() / rounds);
+}
+
+void bench(driver::cc_debugger &dev) {
+  dev.enter();
+
+  fmt::print("probe caps: {:#06x}\n", dev.caps());
+
+  std::vector<uint8_t> buf(dev.info().flash * dev.info().page_size);
+
+  bench_read(dev, "iram", 256, [&] {
+    dev.read_data_raw(0x0, buf.data(), 256);
+  });
+  bench_read(dev, "sfr", 128, [&] {
+    dev.read_sfr_raw(0x80, buf.data(), 128);
+  });
+  bench_read(dev, "xdata", 0x1000, [&] {
+    dev.read_xdata_raw(0xF000, buf.data(), 0x1000);
+  });
+  bench_read(dev, "code", buf.size(), [&] {
+    dev.read_code_raw(0x0, buf.data(), buf.size());
+  });
+}
+
 constexpr unsigned int str_hash(const char *str, int h = 0) {
   return !str[h] ? 5381 : (str_hash(str, h + 1) * 33) ^ str[h];
 }
@@ -89,7 +129,7 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  driver::cc_debugger dev("/dev/ttyACM0");
+  driver::cc_debugger dev(argc > 2 ? argv[2] : "/dev/ttyACM0");
 
   const auto cmd = str_hash(argv[1]);
   if (cmd != str_hash("reset") && !dev.detect()) {
@@ -107,6 +147,10 @@ int main(int argc, char *argv[]) {
     read_flash(dev);
     break;
 
+  case str_hash("bench"):
+    bench(dev);
+    break;
+
   case str_hash("resume"):
     dev.resume();
     break;